@@ -36,6 +36,8 @@ std::string LoopProcessor::SlotFst = "fst";
 std::string LoopProcessor::SlotCnetLattice = "cnet_lattice";
 std::string LoopProcessor::GatherRuntimeStats = "gather_runtime_stats";
 std::string LoopProcessor::QuietGodec = "quiet_godec";
+std::string LoopProcessor::NumShards = "godec_num_shards";
+std::string LoopProcessor::ShardIndex = "godec_shard_index";
 std::string LoopProcessor::SlotTimeMap = "time_map";
 std::string LoopProcessor::SlotControl = "control";
 std::string LoopProcessor::SlotSearchOutput = "fst_search_output";
@@ -106,6 +108,8 @@ void LoopProcessor::addInputSlotAndUUID(std::string slot, uuid _uuid) {
     mInputSlots[slot].insert(_uuid);
 }
 
+static std::mutex GlobalChannelPointerListMutex;
+
 void LoopProcessor::initOutputs(std::list<std::string> requiredSlots) {
     unordered_set<std::string> filledInSlots;
     if (mPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("outputs")) {
@@ -116,6 +120,8 @@ void LoopProcessor::initOutputs(std::list<std::string> requiredSlots) {
             mOutputSlot2Tag[slot] = tag;
             mOutputSlots[slot] = std::set < channel<DecoderMessage_ptr>* >();
             filledInSlots.insert(slot);
+            // Components of one graph get constructed concurrently, and they all register here
+            std::lock_guard<std::mutex> lock(GlobalChannelPointerListMutex);
             if (mPt->globalVals.globalChannelPointerList->find(tag) != mPt->globalVals.globalChannelPointerList->end()) GODEC_ERR << getLPId(false) << ":Trying to redefine output slot '" << tag << "'" << std::endl;
             (*(mPt->globalVals.globalChannelPointerList))[tag] = &mOutputSlots[slot];
         }
@@ -208,16 +214,12 @@ void LoopProcessor::Start() {
 }
 
 std::string LoopProcessor::getLPId(bool withTime, bool trimmed) {
-    std::stringstream ss;
     std::string trimmedId = mId;
     if (trimmed) {
         if (trimmedId.find(ComponentGraph::TOPLEVEL_ID) != std::string::npos) trimmedId = trimmedId.substr((ComponentGraph::TOPLEVEL_ID + ComponentGraph::TREE_LEVEL_SEPARATOR).length());
         if (trimmedId.find(ComponentGraph::API_ENDPOINT_SUFFIX) != std::string::npos) trimmedId = trimmedId.substr(0, trimmedId.length()- ComponentGraph::API_ENDPOINT_SUFFIX.length());
     }
-    ss << trimmedId;
     if (withTime) {
-        ss.precision(6);
-        ss << std::fixed;
 #ifdef ANDROID
         // Switch to timespec_get on Android once it is available
         auto seconds = (boost::posix_time::microsec_clock::local_time() - boost::posix_time::ptime(boost::gregorian::date(1970, 1, 1))).total_nanoseconds()/1.0E9;
@@ -226,9 +228,12 @@ std::string LoopProcessor::getLPId(bool withTime, bool trimmed) {
         timespec_get(&ts, TIME_UTC);
         auto seconds = ts.tv_sec+ts.tv_nsec/1.0E9;
 #endif
-        ss << "(" << seconds << ")";
+        // This gets called for every verbose message, so no stringstream here
+        char timeString[32];
+        snprintf(timeString, sizeof(timeString), "(%.6f)", (double)seconds);
+        trimmedId += timeString;
     }
-    return ss.str();
+    return trimmedId;
 }
 
 void LoopProcessor::startDecodingLoop() {
@@ -325,7 +330,14 @@ void LoopProcessor::Shutdown() {
             (*channelIt)->checkOut(mOutputSlot2Tag[slotIt->first]);
         }
     }
-    mIsFinished = true;
+    setFinished();
+}
+
+void LoopProcessor::setFinished() {
+    // Component output should be out by the time the graph is considered shut down
+    FlushLog();
+    if (mComponentGraph != nullptr) mComponentGraph->ComponentFinished(this);
+    else mIsFinished = true;
 }
 
 void LoopProcessor::addToInputChannel(DecoderMessage_ptr msg) {
@@ -353,6 +365,8 @@ void LoopProcessor::pushToOutputs(std::string slot, DecoderMessage_ptr msg) {
 GlobalComponentGraphVals::GlobalComponentGraphVals() {
     put<bool>(LoopProcessor::GatherRuntimeStats, false);
     put<bool>(LoopProcessor::QuietGodec, false);
+    put<int>(LoopProcessor::NumShards, 1);
+    put<int>(LoopProcessor::ShardIndex, 0);
 }
 
 void GlobalComponentGraphVals::loadGlobals(ComponentGraphConfig& pt) {
@@ -443,6 +457,47 @@ ComponentGraphConfig* ComponentGraphConfig::GetSubtree(std::string key, bool rem
     return out;
 }
 
+std::string ComponentGraphConfig::ResolveGlobalVarsInString(const std::string& in, bool errorOnUndefined) {
+#ifdef USE_STD_REGEX
+    static const std::regex varRegex("\\$\\(([^)]+)\\)");
+    std::sregex_iterator iter(in.begin(), in.end(), varRegex);
+    std::sregex_iterator end;
+#else
+    static const boost::regex varRegex("\\$\\(([^)]+)\\)");
+    boost::sregex_iterator iter(in.begin(), in.end(), varRegex);
+    boost::sregex_iterator end;
+#endif
+    std::string out;
+    size_t prevEnd = 0;
+    for (; iter != end; iter++) {
+        std::string var = (*iter)[1].str();
+        auto varIt = mResolvedVars.find(var);
+        if (varIt == mResolvedVars.end()) {
+            if (!globalVals.exists(var)) {
+                if (errorOnUndefined) GODEC_ERR << mId << ": Global variable '" << var << "' is not defined!" << std::endl;
+                continue;
+            }
+            varIt = mResolvedVars.emplace(var, globalVals.get<std::string>(var)).first;
+        }
+        out.append(in, prevEnd, iter->position() - prevEnd);
+        out += varIt->second;
+        prevEnd = iter->position() + iter->length();
+    }
+    out.append(in, prevEnd, std::string::npos);
+    return out;
+}
+
+void ComponentGraphConfig::ResolveGlobalVars() {
+    for(auto v = pt.begin(); v != pt.end(); v++) {
+        // The Submodule's override tree gets resolved inside the sub-graph, against its own globals
+        if (v.key()[0] == '#' || v.key() == "override" || !v.value().is_string()) continue;
+        const std::string& val = v.value().get_ref<const std::string&>();
+        if (val.find("$(") == std::string::npos) continue;
+        // Undefined vars are left in place, get() complains about them if the parameter is actually used
+        v.value() = ResolveGlobalVarsInString(val, false);
+    }
+}
+
 std::string ComponentGraphConfig::AsString() {
     return pt.dump(4);
 }
@@ -12,6 +12,9 @@
 #include "core_components/ApiEndpoint.h"
 #include "core_components/SubModule.h"
 #include <iomanip>
+#include <fstream>
+#include <atomic>
+#include <exception>
 
 #ifndef _MSC_VER
 #include <dlfcn.h>
@@ -24,6 +27,7 @@ namespace Godec {
 std::string ComponentGraph::API_ENDPOINT_SUFFIX = "(Endpoint)";
 std::string ComponentGraph::TOPLEVEL_ID = "Toplevel";
 std::string ComponentGraph::TREE_LEVEL_SEPARATOR = ".";
+std::string ComponentGraph::COMPILED_GRAPH_MAGIC = "GODECGRAPH";
 
 ComponentGraph::ComponentGraph(std::string prefix, std::string inFile, ComponentGraphConfig* overrideTree, json& injectedEndpoints, GlobalComponentGraphVals* globalVals) {
 #ifdef GODEC_TIMEBOMB
@@ -40,7 +44,28 @@ ComponentGraph::ComponentGraph(std::string prefix, std::string inFile, Component
     mId = prefix;
 
     if (!globalVals->get<bool>(LoopProcessor::QuietGodec)) GODEC_INFO << GetIndentationString(prefix) << "Submodule " << prefix << " (" << inFile << ")" << std::endl;
-    ComponentGraphConfig config(prefix, inFile, globalVals, this);
+    json compiledGraph;
+    if (IsCompiledGraphFile(inFile)) {
+        if (overrideTree->numChildren() != 0) GODEC_ERR << "Overrides can't be applied to compiled graph " << inFile << ", specify them when compiling the graph instead";
+        compiledGraph = LoadCompiledGraph(inFile);
+        // Endpoints injected through the API are the only thing that gets added on top
+        json components;
+        OverlayPropertyTrees(compiledGraph["components"], "", injectedEndpoints, "", components);
+        compiledGraph["components"] = components;
+    } else {
+        compiledGraph = CompileGraph(prefix, inFile, overrideTree, injectedEndpoints, globalVals, false);
+    }
+    InstantiateComponents(compiledGraph, globalVals);
+}
+
+ComponentGraph::ComponentGraph(std::string prefix, json& compiledGraph, GlobalComponentGraphVals* globalVals) {
+    mId = prefix;
+    if (!globalVals->get<bool>(LoopProcessor::QuietGodec)) GODEC_INFO << GetIndentationString(prefix) << "Submodule " << prefix << " (" << compiledGraph["source_file"].get<std::string>() << ")" << std::endl;
+    InstantiateComponents(compiledGraph, globalVals);
+}
+
+json ComponentGraph::CompileGraph(std::string prefix, std::string inFile, ComponentGraphConfig* overrideTree, json& injectedEndpoints, GlobalComponentGraphVals* globalVals, bool expandSubmodules) {
+    ComponentGraphConfig config(prefix, inFile, globalVals, NULL);
     config.AddSubtree(injectedEndpoints);
     config.AddSubtree(overrideTree->GetPtree());
     if (!config.globalVals.get<bool>(LoopProcessor::QuietGodec)) {
@@ -48,20 +73,21 @@ ComponentGraph::ComponentGraph(std::string prefix, std::string inFile, Component
     }
 
     std::string cwd = CdToFilePath(inFile);
-
-    // Instantiate components
-    unordered_set<std::string> seenComponents;
+    json compiledGraph;
+    compiledGraph["source_file"] = inFile;
+    compiledGraph["working_dir"] = boost::filesystem::current_path().string();
 
     for(auto v = config.GetPtree().begin(); v != config.GetPtree().end(); v++) {
         if (v.key() == "global_opts") {
-            ComponentGraphConfig* subConfig = new ComponentGraphConfig("globals", v.value(), &config.globalVals, this);
+            ComponentGraphConfig* subConfig = new ComponentGraphConfig("globals", v.value(), &config.globalVals, NULL);
             subConfig->AddSubtree(overrideTree->GetSubtree(v.key(), true)->GetPtree());
             config.globalVals.loadGlobals(*subConfig);
         }
     }
+    compiledGraph["global_opts"] = config.globalVals.keyVals;
+    compiledGraph["components"] = json::object();
 
     for(auto v = config.GetPtree().begin(); v != config.GetPtree().end(); v++) {
-        LoopProcessor* lp = NULL;
         if (v.key().substr(0, 1) == "#") continue;
         if (overrideTree->get_optional_READ_DECLARATION_BEFORE_USE<std::string>(v.key()) && (overrideTree->get_json_child(v.key()).size() == 0)) {
             std::string val = overrideTree->get<std::string>(v.key(),"");
@@ -69,25 +95,113 @@ ComponentGraph::ComponentGraph(std::string prefix, std::string inFile, Component
         }
         if (v.key() == "global_opts") continue;
         std::string componentName = (prefix != "") ? prefix + ComponentGraph::TREE_LEVEL_SEPARATOR + v.key() : v.key();
-        std::string componentType;
 
-        ComponentGraphConfig* subConfig = new ComponentGraphConfig(componentName, v.value(), &config.globalVals, this);
+        ComponentGraphConfig subConfig(componentName, v.value(), &config.globalVals, NULL);
+        overrideTree->GetSubtree(v.key(), true) ;
+        subConfig.AddSubtree(overrideTree->GetSubtree(v.key(), true)->GetPtree());
+        subConfig.ResolveGlobalVars();
+        if (expandSubmodules && IsSubmoduleType(v.value()["type"])) {
+            subConfig.GetPtree()["compiled_graph"] = Submodule::CompileSubgraph(componentName, &subConfig);
+        }
+        compiledGraph["components"][v.key()] = subConfig.GetPtree();
+    }
+
+    boost::filesystem::current_path(cwd);
+    return compiledGraph;
+}
+
+void ComponentGraph::InstantiateComponents(json& compiledGraph, GlobalComponentGraphVals* globalVals) {
+    std::string prefix = mId;
+
+    GlobalComponentGraphVals levelGlobals(*globalVals);
+    for(auto v = compiledGraph["global_opts"].begin(); v != compiledGraph["global_opts"].end(); v++) {
+        // Quietness is a property of the current run, not of the graph. Same for the shard a sharded Submodule instantiates this graph for
+        if (v.key() == LoopProcessor::QuietGodec || v.key() == LoopProcessor::NumShards || v.key() == LoopProcessor::ShardIndex) continue;
+        levelGlobals.put(v.key(), Json2String(v.value()));
+    }
+
+    std::string cwd = boost::filesystem::current_path().string();
+    boost::filesystem::current_path(compiledGraph["working_dir"].get<std::string>());
+
+    // Instantiate components. Construction (which is where components load their models) is independent between components, so it is done on a thread pool. Only the wiring afterwards needs all of them to exist
+    struct PendingComponent {
+        std::string name;
+        std::string key;
+        std::string type;
+        ComponentGraphConfig* config;
+        LoopProcessor* lp;
+        double constructionTime;
+    };
+    std::vector<PendingComponent> pending;
+    auto& components = compiledGraph["components"];
+    for(auto v = components.begin(); v != components.end(); v++) {
+        std::string componentName = (prefix != "") ? prefix + ComponentGraph::TREE_LEVEL_SEPARATOR + v.key() : v.key();
+
+        ComponentGraphConfig* subConfig = new ComponentGraphConfig(componentName, v.value(), &levelGlobals, this);
         subConfig->globalVals.globalChannelPointerList = &mGlobalOutputSlots;
 
-        componentType = v.value()["type"];
-        if (mComponents.find(componentName) != mComponents.end()) {
-            GODEC_ERR << "Multiple components with the name " << componentName << " found." << std::endl;
+        std::string componentType = v.value()["type"];
+        for(auto it = pending.begin(); it != pending.end(); it++) {
+            if (it->name == componentName) GODEC_ERR << "Multiple components with the name " << componentName << " found." << std::endl;
         }
+        pending.push_back({componentName, v.key(), componentType, subConfig, NULL, 0.0});
+    }
 
-        seenComponents.insert(componentName);
+    auto constructComponent = [this](PendingComponent& comp) {
+        boost::timer::cpu_timer timer;
+        comp.lp = LoadComponent(comp.type, comp.name, comp.config);
+        comp.config->ParameterCheck();
+        comp.constructionTime = boost::chrono::duration<double>(boost::chrono::nanoseconds(timer.elapsed().wall)).count();
+    };
+    auto printComponent = [&](PendingComponent& comp) {
+        if (!globalVals->get<bool>(LoopProcessor::QuietGodec)) GODEC_INFO << GetIndentationString(prefix) << "  +" << comp.key << " (" << comp.type << ") " << std::fixed << std::setprecision(3) << comp.constructionTime << "s" << std::endl << std::flush;
+    };
+
+    // Submodules change the working directory while loading, and the Java/Python components set up their interpreter in the constructing thread. Those get constructed sequentially afterwards
+    std::vector<PendingComponent*> parallelComps;
+    std::vector<PendingComponent*> sequentialComps;
+    for(auto it = pending.begin(); it != pending.end(); it++) {
+        if (RequiresSequentialConstruction(it->type)) sequentialComps.push_back(&(*it));
+        else parallelComps.push_back(&(*it));
+    }
 
-        if (!globalVals->get<bool>(LoopProcessor::QuietGodec)) GODEC_INFO << GetIndentationString(prefix) << "  +" << v.key() << " (" << componentType << ")" << std::endl << std::flush;
-        overrideTree->GetSubtree(v.key(), true) ;
-        subConfig->AddSubtree(overrideTree->GetSubtree(v.key(), true)->GetPtree());
-        lp = LoadComponent(componentType, componentName, subConfig);
+    size_t numThreads = std::min((size_t)std::max(boost::thread::hardware_concurrency(), 1u), parallelComps.size());
+    if (numThreads <= 1) {
+        for(auto it = parallelComps.begin(); it != parallelComps.end(); it++) {
+            constructComponent(**it);
+            printComponent(**it);
+        }
+    } else {
+        std::atomic<size_t> nextComp(0);
+        std::vector<std::exception_ptr> errors(numThreads);
+        std::vector<boost::thread> workers;
+        for(size_t threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+            workers.push_back(boost::thread([&, threadIdx]() {
+                try {
+                    for(size_t compIdx = nextComp++; compIdx < parallelComps.size(); compIdx = nextComp++) {
+                        constructComponent(*parallelComps[compIdx]);
+                        printComponent(*parallelComps[compIdx]);
+                    }
+                } catch (...) {
+                    errors[threadIdx] = std::current_exception();
+                    // Make the other workers run out of work
+                    nextComp = parallelComps.size();
+                }
+            }));
+        }
+        for(auto it = workers.begin(); it != workers.end(); it++) it->join();
+        for(auto it = errors.begin(); it != errors.end(); it++) {
+            if (*it) std::rethrow_exception(*it);
+        }
+    }
+
+    for(auto it = sequentialComps.begin(); it != sequentialComps.end(); it++) {
+        constructComponent(**it);
+        printComponent(**it);
+    }
 
-        subConfig->ParameterCheck();
-        mComponents[componentName] = boost::shared_ptr<LoopProcessor>(lp);
+    for(auto it = pending.begin(); it != pending.end(); it++) {
+        mComponents[it->name] = boost::shared_ptr<LoopProcessor>(it->lp);
     }
 
     for(auto it = mComponents.begin(); it != mComponents.end(); it++) {
@@ -102,6 +216,79 @@ ComponentGraph::ComponentGraph(std::string prefix, std::string inFile, Component
     boost::filesystem::current_path(cwd);
 }
 
+void ComponentGraph::ValidateCompiledGraph(json& compiledGraph, std::string prefix) {
+    auto& components = compiledGraph["components"];
+    unordered_set<std::string> streams;
+    for(auto v = components.begin(); v != components.end(); v++) {
+        std::string componentName = prefix + ComponentGraph::TREE_LEVEL_SEPARATOR + v.key();
+        if (v.value().count("type") == 0) GODEC_ERR << componentName << ": No 'type' specified";
+        if (v.value().count("outputs") == 0) continue;
+        auto& outputs = v.value()["outputs"];
+        for(auto outIt = outputs.begin(); outIt != outputs.end(); outIt++) {
+            std::string tag = Json2String(outIt.value());
+            if (streams.find(tag) != streams.end()) GODEC_ERR << componentName << ": Trying to redefine output slot '" << tag << "'";
+            streams.insert(tag);
+        }
+    }
+    for(auto v = components.begin(); v != components.end(); v++) {
+        std::string componentName = prefix + ComponentGraph::TREE_LEVEL_SEPARATOR + v.key();
+        if (v.value().count("inputs") != 0) {
+            auto& inputs = v.value()["inputs"];
+            for(auto inIt = inputs.begin(); inIt != inputs.end(); inIt++) {
+                std::string tag = Json2String(inIt.value());
+                if (streams.find(tag) != streams.end()) continue;
+                // The toplevel can legitimately be fed from API endpoints that only get injected at load time
+                if (prefix == TOPLEVEL_ID) GODEC_INFO << componentName << ": Input stream '" << tag << "' is not produced inside the graph, it needs to be provided through the API";
+                else GODEC_ERR << componentName << ": No such output slot '" << tag << "'";
+            }
+        }
+        if (v.value().count("compiled_graph") != 0) ValidateCompiledGraph(v.value()["compiled_graph"], componentName);
+    }
+}
+
+bool ComponentGraph::IsSubmoduleType(std::string compType) {
+    std::vector<std::string> els;
+    boost::split(els, compType,boost::is_any_of(":"));
+    return (els.size() == 1 && els[0] == "SubModule") || (els.size() == 2 && els[0] == "core" && els[1] == "SubModule");
+}
+
+bool ComponentGraph::RequiresSequentialConstruction(std::string compType) {
+    std::vector<std::string> els;
+    boost::split(els, compType,boost::is_any_of(":"));
+    if (els.size() == 2 && els[0] != "core") return false;
+    std::string coreType = els.back();
+    return coreType == "SubModule" || coreType == "Java" || coreType == "Python";
+}
+
+bool ComponentGraph::IsCompiledGraphFile(std::string inFile) {
+    std::ifstream input(inFile, std::ios::binary);
+    std::string magic(COMPILED_GRAPH_MAGIC.size(), '\0');
+    input.read(&magic[0], magic.size());
+    return input && magic == COMPILED_GRAPH_MAGIC;
+}
+
+void ComponentGraph::SaveCompiledGraph(json& compiledGraph, std::string outFile) {
+    compiledGraph["godec_version"] = GODEC_VERSION_STRING;
+    std::ofstream output(outFile, std::ios::binary);
+    if (output.fail()) GODEC_ERR << "Could not open '" << outFile << "' for writing";
+    output.write(COMPILED_GRAPH_MAGIC.data(), COMPILED_GRAPH_MAGIC.size());
+    json::to_cbor(compiledGraph, output);
+    if (output.fail()) GODEC_ERR << "Failed writing compiled graph to '" << outFile << "'";
+}
+
+json ComponentGraph::LoadCompiledGraph(std::string inFile) {
+    std::ifstream input(inFile, std::ios::binary);
+    input.seekg(COMPILED_GRAPH_MAGIC.size());
+    json compiledGraph;
+    try {
+        compiledGraph = json::from_cbor(input);
+    } catch (const json::exception& e) {
+        GODEC_ERR << "Could not load compiled graph '" << inFile << "', error: " << e.what();
+    }
+    if (compiledGraph["godec_version"] != GODEC_VERSION_STRING) GODEC_ERR << "Graph " << inFile << " was compiled with Godec version " << compiledGraph["godec_version"] << ", whereas this version is " << GODEC_VERSION_STRING << ". Recompile the graph.";
+    return compiledGraph;
+}
+
 std::string ComponentGraph::GetIndentationString(std::string id) {
 
     int numIndent = 0;
@@ -128,6 +315,8 @@ LoopProcessor* ComponentGraph::LoadComponent(std::string compType, std::string c
         componentName = els[1];
     }
     DllPtr dllHandle;
+    // Components get constructed concurrently
+    std::unique_lock<std::mutex> lock(mComponentsMutex);
     if (mGlobalDllName2Handle == nullptr) mGlobalDllName2Handle = boost::shared_ptr< unordered_map<std::string, DllPtr > >(new unordered_map<std::string, DllPtr >());
     if (mGlobalDllName2Handle->find(dllName) != mGlobalDllName2Handle->end()) {
         dllHandle = (*mGlobalDllName2Handle)[dllName];
@@ -135,6 +324,7 @@ LoopProcessor* ComponentGraph::LoadComponent(std::string compType, std::string c
         dllHandle = LoadGodecLibrary(dllName);
         (*mGlobalDllName2Handle)[dllName] = dllHandle;
     }
+    lock.unlock();
 #ifdef _MSC_VER
     GodecGetComponentFunc loadFunc = (GodecGetComponentFunc)GetProcAddress(dllHandle,"GodecGetComponent");
 #else
@@ -189,7 +379,7 @@ unordered_map<std::string, boost::shared_ptr<RuntimeStats> > ComponentGraph::get
 }
 
 ComponentGraph::~ComponentGraph() {
-    std::lock_guard<std::mutex> lock(mComponentsMutex);
+    std::unique_lock<std::mutex> lock(mComponentsMutex);
     std::stringstream ss;
     if (mId == TOPLEVEL_ID && !mComponents.empty() && mComponents.begin()->second->getRuntimeStats().size() != 0) {
         float highestTotalTime = -FLT_MAX;
@@ -228,7 +418,11 @@ ComponentGraph::~ComponentGraph() {
         if (ss.str() != "") GODEC_INFO << "################## " << mId << ": Component throughput in ticks/second ###########" << std::endl << ss.str() << "###########################" << std::endl;
     }
 
-    mComponents.clear(); // This should call the respective destructors (which might lie across the DLL boundary)
+    // The components get destroyed (which joins their threads, and might lie across the DLL boundary) only after the lock is released, components still shutting down need it in ComponentFinished()
+    unordered_map<std::string, boost::shared_ptr<LoopProcessor>> components;
+    components.swap(mComponents);
+    lock.unlock();
+    components.clear();
     if (mId == TOPLEVEL_ID) {
         // It looks weird to transfer over the handles over to a loval vector. Problem is, when we unload the libraries, it destroys the unordered_map because the libraries are aware of it
         std::vector<DllPtr> handles2Delete;
@@ -287,26 +481,33 @@ boost::shared_ptr<ApiEndpoint> ComponentGraph::GetApiEndpoint(std::string compNa
 }
 
 void ComponentGraph::DeleteApiEndpoint(std::string endpointName) {
-    std::lock_guard<std::mutex> lock(mComponentsMutex);
+    std::unique_lock<std::mutex> lock(mComponentsMutex);
     auto it = mComponents.find(endpointName + API_ENDPOINT_SUFFIX);
     if (it == mComponents.end()) GODEC_ERR << mId << "No such endpoint " << endpointName;
+    // The endpoint gets destroyed (which joins its thread) only after the lock is released, its thread needs the lock for shutting down
+    boost::shared_ptr<LoopProcessor> endpoint = it->second;
     mComponents.erase(it);
+    mShutdownCondition.notify_all();
+    lock.unlock();
 }
 
 void ComponentGraph::WaitTilShutdown() {
-    bool allShutdown = true;
-    do {
-        allShutdown = true;
-        boost::this_thread::sleep(boost::posix_time::seconds(1));
-        {
-            std::lock_guard<std::mutex> lock(mComponentsMutex);
-            for (auto it = mComponents.begin(); it != mComponents.end(); it++) {
-                if (!it->second->mIsFinished) {
-                    allShutdown = false;
-                }
-            }
+    std::unique_lock<std::mutex> lock(mComponentsMutex);
+    auto allShutdown = [this]() {
+        for (auto it = mComponents.begin(); it != mComponents.end(); it++) {
+            if (!it->second->mIsFinished) return false;
         }
-    } while (!allShutdown);
+        return true;
+    };
+    // Components signal through ComponentFinished(). The timeout is only a fallback for components that set mIsFinished directly
+    while (!allShutdown()) mShutdownCondition.wait_for(lock, std::chrono::seconds(1));
+}
+
+void ComponentGraph::ComponentFinished(LoopProcessor* lp) {
+    // Setting the flag under the lock, so the notification can't get lost, and WaitTilShutdown() can't return (and the graph get deleted) before we are done here
+    std::lock_guard<std::mutex> lock(mComponentsMutex);
+    lp->mIsFinished = true;
+    mShutdownCondition.notify_all();
 }
 
 void ComponentGraph::PushMessage(std::string channelName, DecoderMessage_ptr msg) {
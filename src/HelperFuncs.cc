@@ -4,6 +4,11 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/optional/optional.hpp>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <boost/lockfree/queue.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace Godec {
 
@@ -22,11 +27,121 @@ std::string Json2String(json js) {
     return out;
 }
 
-unordered_map<std::string, std::pair<bool, FILE*>> GlobalThreadId2LogHandle;
+struct LogHandle {
+    bool verbose;
+    FILE* logPtr;
+};
+
+struct LogRecord {
+    FILE* logPtr;
+    std::string message;
+};
+
+// Registered handles. Threads cache their own handle, and only come back here when the generation changed, i.e. a thread got registered since
+static std::mutex GlobalThreadId2LogHandleMutex;
+static unordered_map<boost::thread::id, LogHandle, boost::hash<boost::thread::id>> GlobalThreadId2LogHandle;
+static std::atomic<uint64_t> LogHandleGeneration(0);
+
+static const LogHandle& GetThreadLogHandle() {
+    thread_local LogHandle handle = { true, stderr };
+    thread_local uint64_t handleGeneration = UINT64_MAX;
+    uint64_t currentGeneration = LogHandleGeneration.load();
+    if (handleGeneration != currentGeneration) {
+        std::lock_guard<std::mutex> lock(GlobalThreadId2LogHandleMutex);
+        auto it = GlobalThreadId2LogHandle.find(boost::this_thread::get_id());
+        if (it != GlobalThreadId2LogHandle.end()) handle = it->second;
+        handleGeneration = currentGeneration;
+    }
+    return handle;
+}
 
 void RegisterThreadForLogging(boost::thread& thread, FILE* logPtr, bool verbose) {
-    std::string threadId = boost::lexical_cast<std::string>(thread.get_id());
-    GlobalThreadId2LogHandle[threadId] = std::make_pair(verbose, logPtr);
+    std::lock_guard<std::mutex> lock(GlobalThreadId2LogHandleMutex);
+    GlobalThreadId2LogHandle[thread.get_id()] = { verbose, logPtr };
+    LogHandleGeneration++;
+}
+
+bool ThreadLogIsVerbose() {
+    return GetThreadLogHandle().verbose;
+}
+
+// The asynchronous writer. The queue etc are intentionally never freed, other threads might still log during static destruction
+static boost::lockfree::queue<LogRecord*>* LogQueue = nullptr;
+static std::mutex* LogWriteMutex = nullptr;
+static std::mutex* LogWakeupMutex = nullptr;
+static std::condition_variable* LogWakeupCondition = nullptr;
+static boost::thread* LogWriterThread = nullptr;
+static std::atomic<bool> LogWriterIdle(false);
+static std::atomic<bool> LogWriterStopping(false);
+static std::once_flag LogWriterOnce;
+
+// Writes out everything that is queued. Holding the write mutex for the whole pass keeps the messages in order when FlushLog() and the writer thread compete
+static void DrainLogQueue() {
+    std::lock_guard<std::mutex> lock(*LogWriteMutex);
+    unordered_set<FILE*> touchedFiles;
+    LogRecord* record;
+    while (LogQueue->pop(record)) {
+        fprintf(record->logPtr, "%s\n", record->message.c_str());
+        touchedFiles.insert(record->logPtr);
+        delete record;
+    }
+    for (auto it = touchedFiles.begin(); it != touchedFiles.end(); it++) fflush(*it);
+}
+
+static void LogWriterLoop() {
+    while (!LogWriterStopping) {
+        DrainLogQueue();
+        std::unique_lock<std::mutex> lock(*LogWakeupMutex);
+        LogWriterIdle = true;
+        if (LogQueue->empty() && !LogWriterStopping) LogWakeupCondition->wait_for(lock, std::chrono::milliseconds(100));
+        LogWriterIdle = false;
+    }
+}
+
+// The writer thread has to be gone before this library gets unloaded (the component libraries get dlclose'd at shutdown), so it gets stopped from a static destructor. Those also run on regular exit, _exit() callers need to call FlushLog() themselves
+static struct LogWriterStopper {
+    ~LogWriterStopper() {
+        if (LogWriterThread == nullptr) return;
+        {
+            std::lock_guard<std::mutex> lock(*LogWakeupMutex);
+            LogWriterStopping = true;
+            LogWakeupCondition->notify_one();
+        }
+        LogWriterThread->join();
+        FlushLog();
+    }
+} logWriterStopper;
+
+static void StartLogWriter() {
+    std::call_once(LogWriterOnce, []() {
+        LogQueue = new boost::lockfree::queue<LogRecord*>(1024);
+        LogWriteMutex = new std::mutex();
+        LogWakeupMutex = new std::mutex();
+        LogWakeupCondition = new std::condition_variable();
+        LogWriterThread = new boost::thread(&LogWriterLoop);
+    });
+}
+
+static void QueueLogMessage(FILE* logPtr, std::string&& message) {
+    StartLogWriter();
+    if (LogWriterStopping) {
+        // Shutting down, nobody is there to pick it up anymore
+        std::lock_guard<std::mutex> lock(*LogWriteMutex);
+        fprintf(logPtr, "%s\n", message.c_str());
+        fflush(logPtr);
+        return;
+    }
+    LogQueue->push(new LogRecord{ logPtr, std::move(message) });
+    // Only bother with the mutex when the writer is actually sleeping
+    if (LogWriterIdle) {
+        std::lock_guard<std::mutex> lock(*LogWakeupMutex);
+        LogWakeupCondition->notify_one();
+    }
+}
+
+void FlushLog() {
+    if (LogQueue == nullptr) return;
+    DrainLogQueue();
 }
 
 GodecErrorLogger::GodecErrorLogger(LogMessageEnvelope::Severity severity, const char *func, const char *file, int32_t line) {
@@ -69,15 +184,18 @@ void GodecErrorLogger::HandleMessage(const LogMessageEnvelope &envelope, const c
         outString << std::endl << bar << "\033[0m";
     }
 
-    std::string threadId = boost::lexical_cast<std::string>(boost::this_thread::get_id());
-    auto logPair = (GlobalThreadId2LogHandle.find(threadId) != GlobalThreadId2LogHandle.end()) ? GlobalThreadId2LogHandle[threadId] : std::make_pair(true, stderr);
-    if (logPair.first || envelope.severity == LogMessageEnvelope::kError) {
-        fprintf(logPair.second, "%s\n", outString.str().c_str());
-        fflush(logPair.second);
-        if (envelope.severity == LogMessageEnvelope::kError && logPair.second != stderr) { // Make sure errors are seen on command line, no matter what
+    const LogHandle& logHandle = GetThreadLogHandle();
+    if (envelope.severity == LogMessageEnvelope::kError) {
+        // Errors get written right away (after whatever is still queued), since we are about to throw
+        FlushLog();
+        fprintf(logHandle.logPtr, "%s\n", outString.str().c_str());
+        fflush(logHandle.logPtr);
+        if (logHandle.logPtr != stderr) { // Make sure errors are seen on command line, no matter what
             fprintf(stderr, "%s\n", outString.str().c_str());
             fflush(stderr);
         }
+    } else if (logHandle.verbose) {
+        QueueLogMessage(logHandle.logPtr, outString.str());
     }
 
     if (envelope.severity == LogMessageEnvelope::kError) {
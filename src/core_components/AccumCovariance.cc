@@ -2,7 +2,6 @@
 #include <cmath>
 #include "AccumCovariance.h"
 #include <iostream>
-#include <unsupported/Eigen/MatrixFunctions>
 
 namespace Godec {
 
@@ -15,7 +14,11 @@ AccumCovariance::AccumCovariance(int featureDimension, CovarianceType type, bool
     mNormMean = normMean;
     mNormVar = normVar;
     accumMean = Vector(featureDimension);
-    accumCovar = Matrix(featureDimension, featureDimension);
+    if (mType == Diagonal) {
+        accumVar = Vector(featureDimension);
+    } else {
+        accumCovar = Matrix(featureDimension, featureDimension);
+    }
     mDecayRate = decayRate;
     reset();
 }
@@ -23,9 +26,11 @@ AccumCovariance::AccumCovariance(int featureDimension, CovarianceType type, bool
 void AccumCovariance::reset() {
     accumMean.setConstant(0.0f);
     accumCovar.setConstant(0.0f);
+    accumVar.setConstant(0.0f);
     accumN = 0;
     covarIsCurrent = false;
     invCovarIsCurrent = false;
+    whiteningIsCurrent = false;
 }
 
 void AccumCovariance::addData(const Matrix& newData) {
@@ -33,45 +38,94 @@ void AccumCovariance::addData(const Matrix& newData) {
         accumCovar = Matrix::Identity(newData.rows(), newData.rows());
         return;
     }
+    if (mType == Diagonal && newData.rows() == 1) {
+        addScalarData(newData.data(), newData.cols());
+        return;
+    }
 
     int64_t newDataN = newData.cols();
+    if (newDataN == 0) return;
     Vector newDataMean = mNormMean ? (Vector)newData.rowwise().mean() : Vector::Zero(newData.rows());
 
-    Matrix newDataCentered = newData.colwise() - newDataMean;
-    Matrix newDataCovar = (mType == Full) ? newData * newDataCentered.adjoint() : (Matrix)newDataCentered.rowwise().squaredNorm().asDiagonal();
-
     double nX = (double)accumN + (double)newDataN;
     Vector meanDelta = getMean(true) - newDataMean;
     double scaleFactor = (double)accumN*(double)newDataN / nX;
 
-    Matrix meanDeltaSquared = (mType == Full) ? meanDelta*meanDelta.transpose() : (Matrix)((Matrix)meanDelta.asDiagonal()*(Matrix)meanDelta.asDiagonal());
-    accumCovar += newDataCovar + meanDeltaSquared*scaleFactor;
+    if (mType == Diagonal) {
+        // Per-dimension sums only, the centered data is never materialized
+        accumVar += (newData.colwise() - newDataMean).rowwise().squaredNorm() + meanDelta.cwiseAbs2()*scaleFactor;
+    } else {
+        Matrix newDataCentered = newData.colwise() - newDataMean;
+        accumCovar += newData * newDataCentered.adjoint() + meanDelta*meanDelta.transpose()*scaleFactor;
+    }
     accumMean += newDataN*newDataMean;
     accumN = nX;
+    applyDecay(newDataN);
 
-    if (mDecayRate != 1.0f) {
-        double cumDecayRate = exp(log(mDecayRate)*newDataN);
-        accumN *= cumDecayRate; // Simply pretend we have less history
-        accumMean *= cumDecayRate;
-        accumCovar *= cumDecayRate;
+    covarIsCurrent = false;
+    invCovarIsCurrent = false;
+    whiteningIsCurrent = false;
+}
+
+void AccumCovariance::addData(const Vector& newData) {
+    if (mType == Diagonal) {
+        addScalarData(newData.data(), newData.size());
+    } else {
+        addData((Matrix)newData.transpose());
     }
+}
+
+void AccumCovariance::addScalarData(const float* data, int64_t n) {
+    if (accumMean.size() != 1) GODEC_ERR << "AccumCovariance: Got 1-dim data, expected " << accumMean.size() << " dims";
+    if (n == 0) return;
+    Eigen::Map<const Eigen::ArrayXf> x(data, n);
+    double newDataMean = mNormMean ? x.cast<double>().mean() : 0.0;
+    double newDataVar = (x.cast<double>() - newDataMean).square().sum();
+
+    double nX = accumN + (double)n;
+    double meanDelta = getMean(true)(0) - newDataMean;
+    accumVar(0) += newDataVar + meanDelta*meanDelta*accumN*(double)n/nX;
+    accumMean(0) += n*newDataMean;
+    accumN = nX;
+    applyDecay(n);
 
     covarIsCurrent = false;
     invCovarIsCurrent = false;
+    whiteningIsCurrent = false;
 }
 
-void AccumCovariance::addData(const Vector& newData) {
-    addData((Matrix)newData.transpose());
+void AccumCovariance::applyDecay(int64_t n) {
+    if (mDecayRate == 1.0f) return;
+    double cumDecayRate = exp(log(mDecayRate)*n);
+    accumN *= cumDecayRate; // Simply pretend we have less history
+    accumMean *= cumDecayRate;
+    accumCovar *= cumDecayRate;
+    accumVar *= cumDecayRate;
 }
 
 Matrix AccumCovariance::getCovariance(bool biased) {
     if (covarIsCurrent && currentCovarBias == biased) return currentCovar;
-    currentCovar = accumCovar/(accumN - (biased ? 0 : 1));
+    if (mType == Diagonal) {
+        currentCovar = getVariance(biased).asDiagonal();
+    } else {
+        currentCovar = accumCovar/(accumN - (biased ? 0 : 1));
+    }
     covarIsCurrent = true;
     currentCovarBias = biased;
     return currentCovar;
 }
 
+Vector AccumCovariance::getVariance(bool biased) {
+    if (mType == Diagonal) return accumVar/(accumN - (biased ? 0 : 1));
+    return getCovariance(biased).diagonal();
+}
+
+Vector AccumCovariance::getInvStdDev() {
+    Vector var = getVariance(false);
+    if (var.array().abs().minCoeff() > std::numeric_limits<double>::epsilon()) return var.array().inverse().sqrt();
+    return Vector::Ones(var.size());
+}
+
 Vector AccumCovariance::getMean(bool biased) {
     double n = accumN - (biased ? 0 : 1);
     if (n == 0) return Vector::Zero(accumMean.size());
@@ -81,11 +135,11 @@ Vector AccumCovariance::getMean(bool biased) {
 Matrix AccumCovariance::getInvCovariance(bool biased) {
     if (invCovarIsCurrent && currentInvCovarBias == biased) return currentInvCovar;
     if (mType == Diagonal) {
-        currentInvCovar = getCovariance(biased);
-        if (currentInvCovar.diagonal().array().abs().minCoeff() > std::numeric_limits<double>::epsilon()) {
-            currentInvCovar.diagonal() = currentInvCovar.diagonal().array().inverse();
+        Vector var = getVariance(biased);
+        if (var.array().abs().minCoeff() > std::numeric_limits<double>::epsilon()) {
+            currentInvCovar = var.array().inverse().matrix().asDiagonal();
         } else {
-            currentInvCovar = Matrix::Identity(currentInvCovar.rows(), currentInvCovar.cols());
+            currentInvCovar = Matrix::Identity(var.size(), var.size());
         }
     } else {
         currentInvCovar = pinv(getCovariance(biased));
@@ -95,36 +149,55 @@ Matrix AccumCovariance::getInvCovariance(bool biased) {
     return currentInvCovar;
 }
 
+const Matrix& AccumCovariance::getWhitening() {
+    if (whiteningIsCurrent) return currentWhitening;
+    // The covariance is symmetric, so Sigma^-1/2 = V*diag(1/sqrt(lambda))*V'. Near-zero eigenvalues are dropped with the same tolerance as pinv()
+    Eigen::SelfAdjointEigenSolver<Matrix> eig(getCovariance(false));
+    const Vector& eigVals = eig.eigenvalues();
+    float tolerance = std::numeric_limits<double>::epsilon() * eigVals.size() * eigVals.cwiseAbs().maxCoeff();
+    if ((eigVals.array() > tolerance).any()) {
+        Vector invSqrtEigVals = (eigVals.array() > tolerance).select(eigVals.array().max(tolerance).rsqrt(), 0.0f);
+        currentWhitening.noalias() = eig.eigenvectors() * invSqrtEigVals.asDiagonal() * eig.eigenvectors().transpose();
+    } else {
+        currentWhitening = Matrix::Identity(eigVals.size(), eigVals.size());
+    }
+    whiteningIsCurrent = true;
+    return currentWhitening;
+}
+
 Matrix AccumCovariance::normalize(const Matrix& data) {
+    if (mType == Diagonal && mNormVar) {
+        // (x-mean)*invStdDev in one pass
+        Vector offset = mNormMean ? getMean(true) : Vector::Zero(data.rows());
+        return (data.colwise() - offset).array().colwise() * getInvStdDev().array();
+    }
     Matrix meanData = mNormMean ? (data.colwise() - getMean(true)) : data;
-    Matrix invCov = getInvCovariance(false);
-    Matrix sqrtInvCov;
     if (!mNormVar) return meanData;
-    if (mType == Diagonal) {
-        sqrtInvCov = invCov;
-        sqrtInvCov.diagonal() = invCov.diagonal().array().sqrt();
-    } else {
-        sqrtInvCov = invCov.sqrt();
-    }
-    return sqrtInvCov*meanData;
+    return getWhitening()*meanData;
 }
 
 Vector AccumCovariance::normalize(const Vector& data) {
+    if (mType == Diagonal) {
+        float offset = mNormMean ? getMean(true)(0) : 0.0f;
+        float scale = mNormVar ? getInvStdDev()(0) : 1.0f;
+        return (data.array() - offset)*scale;
+    }
     return normalize((Matrix)data.transpose()).row(0);
 }
 
 Vector AccumCovariance::getLogLikelihood(const Matrix& data) {
     Matrix xMinusMu = data.colwise()-getMean(true);
+    if (mType == Diagonal) {
+        Vector var = getVariance(false);
+        Vector invVar = getInvCovariance(false).diagonal();
+        double constTerm = var.array().log().sum()+data.rows()*log(2*M_PI);
+        return (-0.5*((xMinusMu.array().square().colwise()*invVar.array()).colwise().sum().transpose() + constTerm)).matrix();
+    }
     Vector ll(data.cols());
-    double covarLogDet = 0.0;
     Matrix covar = getCovariance(false);
     Matrix invCovar = getInvCovariance(false);
-    if (mType == Diagonal) {
-        covarLogDet = covar.diagonal().array().log().sum();
-    } else {
-        Eigen::ColPivHouseholderQR<Matrix> dec(covar);
-        covarLogDet = dec.logAbsDeterminant();
-    }
+    Eigen::ColPivHouseholderQR<Matrix> dec(covar);
+    double covarLogDet = dec.logAbsDeterminant();
     for(int colIdx = 0; colIdx < data.cols(); colIdx++) {
         ll(colIdx) = -0.5*(covarLogDet+xMinusMu.col(colIdx).transpose()*invCovar*xMinusMu.col(colIdx)+data.rows()*log(2*M_PI));
     }
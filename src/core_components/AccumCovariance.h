@@ -31,18 +31,28 @@ class AccumCovariance {
     Vector normalize(const Vector& data);
     Matrix getCovariance(bool biased);
     Matrix getInvCovariance(bool biased);
+    // Diagonal of the covariance, O(d) for the Diagonal type
+    Vector getVariance(bool biased);
     Vector getMean(bool biased);
     // Produces the log likelihood of each data column, as per current statistics
     Vector getLogLikelihood(const Matrix& data);
     void reset();
   private:
     AccumCovariance(int featureDimension, CovarianceType type, bool normMean, bool normVar, float decayRate);
+    // Diagonal type only: the stats of a 1-dim stream, without any temporaries
+    void addScalarData(const float* data, int64_t n);
+    void applyDecay(int64_t n);
+    // Diagonal type only: 1/sqrt of the unbiased variance, all ones if any variance is ~0
+    Vector getInvStdDev();
+    // Full type only: Sigma^-1/2 of the unbiased covariance, computed once per stats update
+    const Matrix& getWhitening();
     CovarianceType mType;
 
     bool mNormMean;
     bool mNormVar;
 
-    Matrix accumCovar;
+    Matrix accumCovar; // Full type only
+    Vector accumVar; // Diagonal type only
     Vector accumMean;
     double accumN;
     float mDecayRate;
@@ -53,6 +63,8 @@ class AccumCovariance {
     bool currentCovarBias;
     bool invCovarIsCurrent;
     bool currentInvCovarBias;
+    Matrix currentWhitening;
+    bool whiteningIsCurrent;
 };
 
 }
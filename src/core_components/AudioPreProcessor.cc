@@ -1,16 +1,25 @@
 #include "AudioPreProcessor.h"
 #include "godec/ComponentGraph.h"
 #include <iomanip>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GODEC_PCM_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GODEC_PCM_NEON
+#include <arm_neon.h>
+#endif
 
 namespace Godec {
 
-Vector preemphasize(const Vector& audio, float preemphasisFactor) {
-    Vector outAudio = audio;
-    for (int32_t i = outAudio.size() - 1; i >= 1; --i) {
-        outAudio(i) -= preemphasisFactor * outAudio(i - 1);
+// Zero-mean, pre-emphasis and output scaling in one pass, without temporaries. prevSample carries the last zero-meaned sample over to the next chunk
+static void PreprocessChunk(const float* in, float* out, int64_t numSamples, float mean, float preemphasisFactor, float scale, float& prevSample) {
+    Eigen::Map<const Vector> x(in, numSamples);
+    Eigen::Map<Vector> y(out, numSamples);
+    y(0) = ((x(0) - mean) - preemphasisFactor*prevSample)*scale;
+    if (numSamples > 1) {
+        y.tail(numSamples - 1).array() = ((x.tail(numSamples - 1).array() - mean) - preemphasisFactor*(x.head(numSamples - 1).array() - mean))*scale;
     }
-    outAudio(0) *= 1.0 - preemphasisFactor;
-    return outAudio;
+    prevSample = x(numSamples - 1) - mean;
 }
 
 /*
@@ -70,12 +79,134 @@ int Alaw_Decode(unsigned char a_val) {
     return ((a_val & SIGN_BIT) ? t : -t);
 }
 
+// The companded formats only have 256 possible values, so decode them through a table
+static const std::vector<float>& MulawTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> t(256);
+        for (int i = 0; i < 256; i++) t[i] = Mulaw_Decode((unsigned char)i);
+        return t;
+    }();
+    return table;
+}
+
+static const std::vector<float>& AlawTable() {
+    static const std::vector<float> table = [] {
+        std::vector<float> t(256);
+        for (int i = 0; i < 256; i++) t[i] = Alaw_Decode((unsigned char)i);
+        return t;
+    }();
+    return table;
+}
+
+// De-interleaves and converts mono/stereo 16 and 32 bit PCM with SSE2/NEON, a block of frames at a time (Eigen has no int16 packet cast, and no packet access through a runtime stride). Returns the number of frames done, the rest is left to the caller
+template<typename T>
+static int32_t DecodePcmSimd(const T* in, int32_t numSamples, int numChannels, float* out0, float* out1) {
+    return 0;
+}
+
+template<>
+int32_t DecodePcmSimd<int16_t>(const int16_t* in, int32_t numSamples, int numChannels, float* out0, float* out1) {
+    int32_t sampleIdx = 0;
+#if defined(GODEC_PCM_SSE2)
+    if (numChannels == 1) {
+        for (; sampleIdx + 8 <= numSamples; sampleIdx += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(in + sampleIdx));
+            // Duplicating each sample into both halves of a 32 bit lane and shifting back down sign-extends it
+            _mm_storeu_ps(out0 + sampleIdx, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)));
+            _mm_storeu_ps(out0 + sampleIdx + 4, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)));
+        }
+    } else if (numChannels == 2) {
+        for (; sampleIdx + 4 <= numSamples; sampleIdx += 4) {
+            // Each 32 bit lane is one frame, left channel in the low half
+            __m128i v = _mm_loadu_si128((const __m128i*)(in + 2*sampleIdx));
+            _mm_storeu_ps(out0 + sampleIdx, _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16)));
+            _mm_storeu_ps(out1 + sampleIdx, _mm_cvtepi32_ps(_mm_srai_epi32(v, 16)));
+        }
+    }
+#elif defined(GODEC_PCM_NEON)
+    if (numChannels == 1) {
+        for (; sampleIdx + 8 <= numSamples; sampleIdx += 8) {
+            int16x8_t v = vld1q_s16(in + sampleIdx);
+            vst1q_f32(out0 + sampleIdx, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))));
+            vst1q_f32(out0 + sampleIdx + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))));
+        }
+    } else if (numChannels == 2) {
+        for (; sampleIdx + 8 <= numSamples; sampleIdx += 8) {
+            int16x8x2_t v = vld2q_s16(in + 2*sampleIdx);
+            vst1q_f32(out0 + sampleIdx, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[0]))));
+            vst1q_f32(out0 + sampleIdx + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[0]))));
+            vst1q_f32(out1 + sampleIdx, vcvtq_f32_s32(vmovl_s16(vget_low_s16(v.val[1]))));
+            vst1q_f32(out1 + sampleIdx + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(v.val[1]))));
+        }
+    }
+#endif
+    return sampleIdx;
+}
+
+template<>
+int32_t DecodePcmSimd<int32_t>(const int32_t* in, int32_t numSamples, int numChannels, float* out0, float* out1) {
+    int32_t sampleIdx = 0;
+    // Mono is a plain contiguous cast, which Eigen vectorizes by itself
+    if (numChannels != 2) return 0;
+#if defined(GODEC_PCM_SSE2)
+    for (; sampleIdx + 4 <= numSamples; sampleIdx += 4) {
+        __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + 2*sampleIdx)));
+        __m128 b = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in + 2*sampleIdx + 4)));
+        _mm_storeu_ps(out0 + sampleIdx, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(out1 + sampleIdx, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+#elif defined(GODEC_PCM_NEON)
+    for (; sampleIdx + 4 <= numSamples; sampleIdx += 4) {
+        int32x4x2_t v = vld2q_s32(in + 2*sampleIdx);
+        vst1q_f32(out0 + sampleIdx, vcvtq_f32_s32(v.val[0]));
+        vst1q_f32(out1 + sampleIdx, vcvtq_f32_s32(v.val[1]));
+    }
+#endif
+    return sampleIdx;
+}
+
+// Converts interleaved PCM to one float vector per channel. Mono/stereo 16 and 32 bit go through the SIMD kernels above, mono without a stride also vectorizes in Eigen (for 32 bit). Everything else (8 bit, more than 2 channels, the leftover frames) is a scalar strided cast
+template<typename T>
+static void DecodePcm(const unsigned char* data, int32_t numSamples, int numChannels, std::vector<Vector>& audioVecs) {
+    const T* samples = (const T*)data;
+    for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) audioVecs[channelIdx].resize(numSamples);
+    int32_t numDone = DecodePcmSimd<T>(samples, numSamples, numChannels, audioVecs[0].data(), numChannels > 1 ? audioVecs[1].data() : nullptr);
+    int32_t numLeft = numSamples - numDone;
+    if (numChannels == 1) {
+        audioVecs[0].tail(numLeft) = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>(samples + numDone, numLeft).template cast<float>();
+        return;
+    }
+    for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+        Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>, Eigen::Unaligned, Eigen::InnerStride<>> channelSamples(samples + (int64_t)numDone*numChannels + channelIdx, numLeft, Eigen::InnerStride<>(numChannels));
+        audioVecs[channelIdx].tail(numLeft) = channelSamples.template cast<float>();
+    }
+}
+
+static void DecodeCompanded(const std::vector<float>& table, const unsigned char* data, int32_t numSamples, int numChannels, std::vector<Vector>& audioVecs) {
+    for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+        audioVecs[channelIdx].resize(numSamples);
+        const unsigned char* samplePtr = data + channelIdx;
+        for (int32_t sampleIdx = 0; sampleIdx < numSamples; sampleIdx++, samplePtr += numChannels) {
+            audioVecs[channelIdx](sampleIdx) = table[*samplePtr];
+        }
+    }
+}
+
+static void DecodeMulaw(const unsigned char* data, int32_t numSamples, int numChannels, std::vector<Vector>& audioVecs) {
+    DecodeCompanded(MulawTable(), data, numSamples, numChannels, audioVecs);
+}
+
+static void DecodeAlaw(const unsigned char* data, int32_t numSamples, int numChannels, std::vector<Vector>& audioVecs) {
+    DecodeCompanded(AlawTable(), data, numSamples, numChannels, audioVecs);
+}
+
 AudioFormatParser AudioFormatParser::FromFormatString(std::string formatString) {
     AudioFormatParser out;
     out.vtlStretch = 1.0f;
     out.numChannels = 1;
     out.sampleWidth = 8;
     out.sampleRate = -1.0f;
+    bool hasBaseFormat = false;
     std::vector<std::string> formatEls;
     boost::split(formatEls, formatString,boost::is_any_of(";"));
     for (auto it = formatEls.begin(); it != formatEls.end(); it++) {
@@ -86,6 +217,7 @@ AudioFormatParser AudioFormatParser::FromFormatString(std::string formatString)
             else if (keyVal[1] == "ulaw") out.baseFormat = MuLaw;
             else if (keyVal[1] == "alaw") out.baseFormat = Alaw;
             else GODEC_ERR << "Unknown base format " << keyVal[1];
+            hasBaseFormat = true;
         } else if (keyVal[0] == "num_channels") {
             out.numChannels = std::atoi(keyVal[1].c_str());
         } else if (keyVal[0] == "sample_width") {
@@ -97,6 +229,19 @@ AudioFormatParser AudioFormatParser::FromFormatString(std::string formatString)
         } //else KALDI_WARN << "Unknown format string element '" << keyVal[0] << "'" <<  std::endl;
     }
     if (out.sampleRate < 0) GODEC_ERR << "Sample rate was not set in format string '" << formatString << "'";
+    if (!hasBaseFormat) GODEC_ERR << "Base format was not set in format string '" << formatString << "'";
+
+    if (out.baseFormat == PCM) {
+        if (out.sampleWidth == 8) out.decode = DecodePcm<int8_t>;
+        else if (out.sampleWidth == 16) out.decode = DecodePcm<int16_t>;
+        else if (out.sampleWidth == 32) out.decode = DecodePcm<int32_t>;
+        else GODEC_ERR << "Unsupported PCM sample width " << out.sampleWidth << " in format string '" << formatString << "'";
+    } else if (out.baseFormat == MuLaw) {
+        out.decode = DecodeMulaw;
+    } else if (out.baseFormat == Alaw) {
+        out.decode = DecodeAlaw;
+    }
+    if (out.decode == nullptr) GODEC_ERR << "No decoder for format string '" << formatString << "'";
     return out;
 }
 
@@ -112,6 +257,10 @@ std::string AudioPreProcessorComponent::describeThyself() {
 
 /* AudioPreProcessorComponent::ExtendedDescription
 This component supports both BinaryDecoderMessage as well as AudioDecoderMessage input in its "stream_audio" slot. The output slots are enumerated in the form of "`streamed_audio_0`", "`streamed_audio_1`" etc, up to the number specified in "`max_out_channels`"
+
+The "resample_quality" parameter (low, medium, high) picks the resampling filter. "medium" is the filter used before this parameter existed. "low" is cheapest, "high" has a much steeper cutoff at several times the cost
+
+The zero-mean statistics get updated every quarter second. Pre-emphasis runs continuously across incoming chunks within an utterance
 */
 
 AudioPreProcessorComponent::AudioPreProcessorComponent(std::string id, ComponentGraphConfig* configPt) :
@@ -125,6 +274,7 @@ AudioPreProcessorComponent::AudioPreProcessorComponent(std::string id, Component
     mTargetSamplingRate = configPt->get<float>("target_sampling_rate", "If required, resample audio to this rate");
     int maxOutChannels = configPt->get<int>("max_out_channels", "maximum number of output channels that need to be defined");
     mOutputScale = configPt->get<float>("output_scale", "Scale the output audio by this factor");
+    mResampleQuality = String2ResampleQuality(configPt->get<std::string>("resample_quality", "Resampling filter quality (low, medium, high)"));
 
     mUttReceivedRawAudio = 0;
     mUttReceivedResampledAudio = 0;
@@ -167,31 +317,19 @@ void AudioPreProcessorComponent::ProcessMessage(const DecoderMessageBlock& msgBl
     } else if (audioBaseMsg->getUUID() == UUID_BinaryDecoderMessage) {
         auto binaryMsg =msgBlock.get<BinaryDecoderMessage>(SlotStreamedAudio);
         auto& binaryData = binaryMsg->mData;
-        AudioFormatParser parser = AudioFormatParser::FromFormatString(binaryMsg->mFormat);
+        // The format hardly ever changes, so only parse it when it does
+        if (binaryMsg->mFormat != mBinaryFormatString) {
+            mBinaryFormat = AudioFormatParser::FromFormatString(binaryMsg->mFormat);
+            mBinaryFormatString = binaryMsg->mFormat;
+        }
+        const AudioFormatParser& parser = mBinaryFormat;
         sampleRate = parser.sampleRate;
         vtlStretch = parser.vtlStretch;
         numChannels = parser.numChannels;
         int bytesPerSample = parser.sampleWidth / 8;
         int32_t numSamples = binaryData.size() / (numChannels*bytesPerSample);
-        for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
-            audioVecs.push_back(Vector(numSamples));
-            for (int sampleIdx = 0; sampleIdx < numSamples; sampleIdx++) {
-                const unsigned char* samplePtr = &binaryData[bytesPerSample*(sampleIdx*numChannels + channelIdx)];
-                if (parser.baseFormat == PCM) {
-                    if (bytesPerSample == 1) {
-                        audioVecs[channelIdx](sampleIdx) = *((int8_t*)samplePtr);
-                    } else if (bytesPerSample == 2) {
-                        audioVecs[channelIdx](sampleIdx) = *((int16_t*)samplePtr);
-                    } else if (bytesPerSample == 4) {
-                        audioVecs[channelIdx](sampleIdx) = *((int32_t*)samplePtr);
-                    }
-                } else if (parser.baseFormat == MuLaw) {
-                    audioVecs[channelIdx](sampleIdx) = Mulaw_Decode(*samplePtr);
-                } else if (parser.baseFormat == Alaw) {
-                    audioVecs[channelIdx](sampleIdx) = Alaw_Decode(*samplePtr);
-                }
-            }
-        }
+        audioVecs.resize(numChannels);
+        parser.decode(binaryData.data(), numSamples, numChannels, audioVecs);
         inputTicksPerSample = (convStateMsg->getTime()-mUttStartStreamOffset)/(double)(mUttReceivedRawAudio+audioVecs[0].size());
     }
 
@@ -201,18 +339,16 @@ void AudioPreProcessorComponent::ProcessMessage(const DecoderMessageBlock& msgBl
         GODEC_ERR << "Due to upsampling from " << sampleRate << "Hz to " << mTargetSamplingRate << "Hz, each audio sample will no longer have a unique time stamp. To fix this, add the optional 'time_upsample_factor' to the FileFeeder or Soundcard component (whichever you are using) to a value of ceil(" << mTargetSamplingRate << "/" << sampleRate << ")=" << std::ceil(1.0 / outputTimePerSample) << " or higher. If the audio is fed via an API, it is the responsibility of them to increase the timestamps by that factor. Note that this factor was calculated based on this specific audio chunk's sampling rate. If you have audio with even lower sampling rate, you might have to increase the upsampling factor even more";
 
     // Init
-    if (mStatsAccumAudio.size() == 0) {
-        mStatsAccumAudio.resize(numChannels);
-        zeroMean.resize(numChannels);
+    if (mChannelState.size() == 0) {
+        mChannelState.resize(numChannels);
         resample.resize(numChannels);
         for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
-            zeroMean[channelIdx] = AccumCovariance::make(1, Diagonal, mDoZeroMean, false);
             resample[channelIdx] = nullptr;
         }
     }
 
     // Maybe at some point this will be supported? It's not clear though what the timestamps would be if you suddenly have a new output stream that didn't exist before
-    if (numChannels != zeroMean.size()) GODEC_ERR << getLPId() << ": Number of incoming channels changed mid-stream (from " << zeroMean.size() << " to " << numChannels << "). This is currently not supported";
+    if (numChannels != mChannelState.size()) GODEC_ERR << getLPId() << ": Number of incoming channels changed mid-stream (from " << mChannelState.size() << " to " << numChannels << "). This is currently not supported";
 
     // Resample
     std::vector<Vector> resampledAudio(numChannels);
@@ -220,8 +356,9 @@ void AudioPreProcessorComponent::ProcessMessage(const DecoderMessageBlock& msgBl
         if (sampleRate != mTargetSamplingRate) {
             if ((resample[channelIdx] == nullptr) || (mPrevSampleRate != sampleRate)) {
                 if (resample[channelIdx] != nullptr) { resample[channelIdx].reset(); }
-                float lowpass_freq = 0.45*std::min(sampleRate, mTargetSamplingRate);
-                int32_t num_zeros = 10; // Totally made-up value. What's good?!
+                float lowpass_freq;
+                int32_t num_zeros;
+                GetResampleFilterParams(mResampleQuality, sampleRate, mTargetSamplingRate, lowpass_freq, num_zeros);
                 resample[channelIdx] = boost::shared_ptr<Godec::LinearResample>(new Godec::LinearResample(sampleRate, mTargetSamplingRate, lowpass_freq, num_zeros));
             }
             mPrevSampleRate = sampleRate;
@@ -236,55 +373,44 @@ void AudioPreProcessorComponent::ProcessMessage(const DecoderMessageBlock& msgBl
 
     mUttReceivedResampledAudio += resampledAudio[0].size();
 
-    for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
-        mStatsAccumAudio[channelIdx].conservativeResize(mStatsAccumAudio[channelIdx].size() + resampledAudio[channelIdx].size());
-        mStatsAccumAudio[channelIdx].tail(resampledAudio[channelIdx].size()) = resampledAudio[channelIdx];
-    }
-
     uint64_t outTimestamp = 0;
     std::vector<Vector> outAudio(numChannels);
+    for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+        outAudio[channelIdx].resize(resampledAudio[channelIdx].size());
+    }
+    int64_t chunkStart = 0;
     while(true) { // Iterate over audio chunks until there is none left. The point of doing it in this chunking way is to make the normalization independent of how much audio we received. If we just normalized over the entirety of what we got into the input channel, the output would be non-deterministic.
         int64_t nextAudioChunkSize = getNextChunkSize();
 
         if (nextAudioChunkSize == 0) break;
 
         for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
-            Vector audioChunk = resampledAudio[channelIdx].segment(0, nextAudioChunkSize);
-            resampledAudio[channelIdx] = (Vector)resampledAudio[channelIdx].tail(resampledAudio[channelIdx].size() - audioChunk.size());
-
-            // Zero-mean
-            Vector normAudioChunk = zeroMean[channelIdx]->normalize(audioChunk);
-            // Pre-emphasize
-            Vector preempAudio;
-            if (mPreemphasisFactor != 0.0f) {
-                preempAudio = preemphasize(normAudioChunk, mPreemphasisFactor);
-            } else {
-                preempAudio = normAudioChunk;
-            }
-
-            if (channelIdx == 0) mUttProducedAudio += preempAudio.size();
-            outTimestamp = mUttStartStreamOffset + (int64_t)round(outputTimePerSample*mUttProducedAudio);
-            if (convStateMsg->mLastChunkInUtt && getNextChunkSize() == 0) {
-                outTimestamp = convStateMsg->getTime();
-            }
+            AudioChannelState& state = mChannelState[channelIdx];
+            const float* chunk = resampledAudio[channelIdx].data() + chunkStart;
+            float mean = (mDoZeroMean && state.statsN > 0) ? state.statsSum / state.statsN : 0.0f;
+            // The very first sample of an utterance has no predecessor, pre-emphasize it against itself
+            if (mUttProducedAudio == 0) state.prevSample = chunk[0] - mean;
+            PreprocessChunk(chunk, outAudio[channelIdx].data() + chunkStart, nextAudioChunkSize, mean, mPreemphasisFactor, mOutputScale, state.prevSample);
+            if (state.hopAudio.size() != mUpdateStatsHop) state.hopAudio.resize(mUpdateStatsHop);
+            state.hopAudio.segment(mUttProducedAudio % mUpdateStatsHop, nextAudioChunkSize) = Eigen::Map<const Vector>(chunk, nextAudioChunkSize);
+        }
+        chunkStart += nextAudioChunkSize;
+        mUttProducedAudio += nextAudioChunkSize;
 
-            outAudio[channelIdx].conservativeResize(outAudio[channelIdx].size() + preempAudio.size());
-            outAudio[channelIdx].tail(preempAudio.size()) = preempAudio;
+        outTimestamp = mUttStartStreamOffset + (int64_t)round(outputTimePerSample*mUttProducedAudio);
+        if (convStateMsg->mLastChunkInUtt && getNextChunkSize() == 0) {
+            outTimestamp = convStateMsg->getTime();
+        }
 
-            // Update the statistics
-            if (mUttProducedAudio % mUpdateStatsHop == 0) {
-                Vector newChunk = mStatsAccumAudio[channelIdx].segment(0, mUpdateStatsHop);
-                mStatsAccumAudio[channelIdx] = (Vector)mStatsAccumAudio[channelIdx].tail(mStatsAccumAudio[channelIdx].size() - newChunk.size());
-                zeroMean[channelIdx]->addData(newChunk);
+        // Update the statistics
+        if (mUttProducedAudio % mUpdateStatsHop == 0) {
+            for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
+                AudioChannelState& state = mChannelState[channelIdx];
+                state.statsSum += state.hopAudio.cast<double>().sum();
+                state.statsN += mUpdateStatsHop;
             }
         }
     }
-    // Rescale output
-    for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
-        for(int sampleIdx = 0; sampleIdx < outAudio[channelIdx].size(); sampleIdx++) {
-            outAudio[channelIdx][sampleIdx] *= mOutputScale;
-        }
-    }
     // Output each channel separately
     for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
         if (outAudio[channelIdx].size() == 0) continue;
@@ -304,7 +430,7 @@ void AudioPreProcessorComponent::ProcessMessage(const DecoderMessageBlock& msgBl
         mUttReceivedResampledAudio = 0;
         mUttProducedAudio = 0;
         for (int channelIdx = 0; channelIdx < numChannels; channelIdx++) {
-            zeroMean[channelIdx]->reset();
+            mChannelState[channelIdx] = AudioChannelState();
             if (resample[channelIdx] != nullptr) resample[channelIdx]->Reset();
         }
     }
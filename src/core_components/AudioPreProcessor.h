@@ -1,7 +1,6 @@
 #pragma once
 
 #include "godec/ChannelMessenger.h"
-#include "AccumCovariance.h"
 #include "GodecMessages.h"
 #include "FileFeeder.h"
 #include "resample.h"
@@ -13,14 +12,24 @@ int Alaw_Decode(unsigned char a_val);
 
 class AudioFormatParser {
   public:
-    AudioType baseFormat;
+    AudioType baseFormat = PCM;
     int sampleWidth;
     int numChannels;
     float sampleRate;
     float vtlStretch;
+    // De-interleaves numSamples samples per channel into audioVecs. Picked once per format, so the per-sample loop has no branches
+    void (*decode)(const unsigned char* data, int32_t numSamples, int numChannels, std::vector<Vector>& audioVecs) = nullptr;
     static AudioFormatParser FromFormatString(std::string);
 };
 
+// Streaming state of one channel. The mean is updated once per stats hop, so the output doesn't depend on how the audio was chunked
+struct AudioChannelState {
+    double statsSum = 0.0;
+    double statsN = 0.0;
+    Vector hopAudio;  ///< The current, not yet complete stats hop. Only summed once complete, so the sum doesn't depend on how the hop arrived
+    float prevSample = 0.0f;  ///< Last zero-meaned sample, for pre-emphasis
+};
+
 class AudioPreProcessorComponent : public LoopProcessor {
   public:
     static LoopProcessor* make(std::string id, ComponentGraphConfig* configPt);
@@ -30,13 +39,16 @@ class AudioPreProcessorComponent : public LoopProcessor {
 
   private:
     void ProcessMessage(const DecoderMessageBlock& msgBlock);
-    std::vector<boost::shared_ptr<AccumCovariance>> zeroMean;
+    std::vector<AudioChannelState> mChannelState;
     std::vector<boost::shared_ptr<Godec::LinearResample>> resample;
-    std::vector<Vector> mStatsAccumAudio;
 
     int64_t getNextChunkSize();
 
+    std::string mBinaryFormatString;
+    AudioFormatParser mBinaryFormat;
+
     float mTargetSamplingRate;
+    ResampleQuality mResampleQuality;
     int64_t mUttReceivedRawAudio;
     int64_t mUttReceivedResampledAudio;
     int64_t mUttProducedAudio;
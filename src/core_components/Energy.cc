@@ -6,6 +6,27 @@ namespace Godec {
 #define MINLARG 1e-25
 #define LZERO 1e-10
 
+Matrix FloorLog(const Matrix& m) {
+    return m.array().max(std::numeric_limits<float>::epsilon()).unaryExpr([](float v) {
+        return std::log(v);
+    }).matrix();
+}
+
+Matrix FloorLog10(const Matrix& m, float floor) {
+    return m.array().max(floor).unaryExpr([](float v) {
+        return std::log10(v);
+    }).matrix();
+}
+
+RowVector FrameEnergies(const Matrix& frames, bool dBEnergy) {
+    RowVector energies = frames.colwise().squaredNorm();
+    if (dBEnergy) {
+        RowVector dBEnergies = 10.0f*FloorLog10(energies, (float)MINLARG);
+        energies = (energies.array() < (float)MINLARG).select((float)LZERO, dBEnergies.array());
+    }
+    return energies;
+}
+
 EnergyComponent::~EnergyComponent() {
 }
 
@@ -30,15 +51,7 @@ void EnergyComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
 
     if (audioMsg->mFeatureNames.substr(0, strlen("WINAUDIO")) != "WINAUDIO") GODEC_ERR << getLPId() << ": Expected windowed audio, got " << audioMsg->mFeatureNames;
 
-    Matrix audioSnippets = audioMsg->mFeatures;
-    Matrix outMat(1, audioSnippets.cols());
-
-    for (int frameIdx = 0; frameIdx < audioSnippets.cols(); frameIdx++) {
-        Vector audio = audioSnippets.col(frameIdx);
-        float energy = audio.squaredNorm();
-        if (mDBEnergy) energy = (energy < MINLARG) ? LZERO : 10.0*log10(energy);
-        outMat(0, frameIdx) = energy;
-    }
+    Matrix outMat = FrameEnergies(audioMsg->mFeatures, mDBEnergy);
 
     pushToOutputs(SlotFeatures, FeaturesDecoderMessage::create(
                       convStateMsg->getTime(), convStateMsg->mUtteranceId,
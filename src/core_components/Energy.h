@@ -5,6 +5,14 @@
 
 namespace Godec {
 
+// Natural log floored at the float epsilon. Done one scalar at a time, since Eigen's vectorized log differs in the last bit from the scalar tail, which would make the output depend on how many frames are in the chunk
+Matrix FloorLog(const Matrix& m);
+// Same for log10 with the given floor (Eigen doesn't vectorize log10 at the moment, but the output shouldn't depend on that either)
+Matrix FloorLog10(const Matrix& m, float floor);
+
+// Energy of each frame (one frame per column), optionally in dB
+RowVector FrameEnergies(const Matrix& frames, bool dBEnergy);
+
 class EnergyComponent : public LoopProcessor {
   public:
     static LoopProcessor* make(std::string id, ComponentGraphConfig* configPt);
@@ -3,16 +3,65 @@
 
 namespace Godec {
 
-NFrameAverager::NFrameAverager(int64_t nFrames, int64_t vectorSize, bool zeroPadToSize) {
-    mNFrames = nFrames;
+FrameRingBuffer::FrameRingBuffer(int64_t vectorSize, int64_t capacity, bool keepSums) {
+    if (capacity < 1) GODEC_ERR << "Frame ring buffer needs a capacity of at least 1, got " << capacity;
+    mFrames = Matrix(vectorSize, capacity);
+    mKeepSums = keepSums;
+    mSum = Eigen::VectorXd(keepSums ? vectorSize : 0);
+    mSumSquares = Eigen::VectorXd(keepSums ? vectorSize : 0);
+    clear();
+}
+
+void FrameRingBuffer::clear() {
+    mOldest = 0;
+    mSize = 0;
+    mSum.setZero();
+    mSumSquares.setZero();
+}
+
+void FrameRingBuffer::push(const Eigen::Ref<const Vector>& frame) {
+    if (mSize == capacity()) popOldest();
+    auto slot = mFrames.col((mOldest + mSize) % capacity());
+    slot = frame;
+    if (mKeepSums) {
+        mSum += slot.cast<double>();
+        mSumSquares += slot.cast<double>().cwiseAbs2();
+    }
+    mSize++;
+}
+
+void FrameRingBuffer::popOldest() {
+    if (mSize == 0) return;
+    if (mKeepSums) {
+        auto slot = mFrames.col(mOldest);
+        mSum -= slot.cast<double>();
+        mSumSquares -= slot.cast<double>().cwiseAbs2();
+    }
+    mOldest = (mOldest + 1) % capacity();
+    mSize--;
+    // Once per trip around the ring, i.e. amortized O(1) per frame
+    if (mKeepSums && mOldest == 0) recomputeSums();
+}
+
+void FrameRingBuffer::recomputeSums() {
+    mSum.setZero();
+    mSumSquares.setZero();
+    for (int64_t idx = 0; idx < mSize; idx++) {
+        mSum += frame(idx).cast<double>();
+        mSumSquares += frame(idx).cast<double>().cwiseAbs2();
+    }
+}
+
+NFrameAverager::NFrameAverager(int64_t nFrames, int64_t vectorSize, bool zeroPadToSize) : mRing(vectorSize, nFrames, false) {
     mZeroPadToSize = zeroPadToSize;
-    mAccum = Matrix(vectorSize,0);
+    mOrderedFrames = Matrix::Zero(vectorSize, nFrames);
 }
 
 NFrameAverager::~NFrameAverager() {}
 
 void NFrameAverager::endOfUtterance() {
-    mAccum = Matrix(mAccum.rows(),0);
+    mRing.clear();
+    mOrderedFrames.setZero();
 }
 
 void NFrameAverager::endOfConvo() {
@@ -23,17 +72,79 @@ void NFrameAverager::previewData(const Matrix& data, bool lastInShow) {
 
 Matrix NFrameAverager::transform(const Matrix& data, bool lastInShow) {
     for(int dataColIdx = 0; dataColIdx < data.cols(); dataColIdx++) {
-        if (mAccum.cols() == mNFrames) {
-            mAccum = mAccum.rightCols(mAccum.cols()-1);
+        mRing.push(data.col(dataColIdx));
+    }
+    // The float sum has to run over the frames oldest first (and zero-padded), like the ring-less version did, to give the same output. So the held frames still get copied once per call, just into a buffer that is allocated only once
+    for (int64_t ringIdx = 0; ringIdx < mRing.size(); ringIdx++) {
+        mOrderedFrames.col(ringIdx) = mRing.frame(ringIdx);
+    }
+    auto frames = mOrderedFrames.leftCols(mZeroPadToSize ? mRing.capacity() : mRing.size());
+    Matrix out = frames.rowwise().sum()/frames.cols();
+    return out;
+}
+
+SlidingWindowNormalizer::SlidingWindowNormalizer(int vectorSize, int64_t windowSize, int64_t lookahead, bool normMean, bool normVar) : mRing(vectorSize, windowSize, true) {
+    if (lookahead < 0 || lookahead >= windowSize) GODEC_ERR << "Sliding window lookahead needs to be between 0 and " << windowSize-1 << ", got " << lookahead;
+    mLookahead = lookahead;
+    mNormMean = normMean;
+    mNormVar = normVar;
+    mMean = Eigen::VectorXd::Zero(vectorSize);
+    mInvStdDev = Eigen::VectorXd::Ones(vectorSize);
+    endOfUtterance();
+}
+
+SlidingWindowNormalizer::~SlidingWindowNormalizer() {}
+
+void SlidingWindowNormalizer::endOfUtterance() {
+    mRing.clear();
+    mNumPushed = 0;
+    mNumOutput = 0;
+}
+
+void SlidingWindowNormalizer::endOfConvo() {
+}
+
+void SlidingWindowNormalizer::previewData(const Matrix& data, bool lastInShow) {
+}
+
+void SlidingWindowNormalizer::normalizeFrame(const Eigen::Ref<const Vector>& frame, Eigen::Ref<Vector> out) {
+    double n = mRing.size();
+    if (mNormMean || mNormVar) mMean = mRing.getSum()/n;
+    if (mNormVar) {
+        // Biased variance over the window, dimensions with (near) zero variance are left unscaled
+        auto var = mRing.getSumSquares().array()/n - mMean.array().square();
+        mInvStdDev = (var > std::numeric_limits<float>::epsilon()).select(var.rsqrt(), 1.0);
+    }
+    if (mNormMean) {
+        out = ((frame.cast<double>() - mMean).array()*mInvStdDev.array()).cast<float>();
+    } else {
+        out = (frame.cast<double>().array()*mInvStdDev.array()).cast<float>();
+    }
+}
+
+Matrix SlidingWindowNormalizer::transform(const Matrix& data, bool lastInShow) {
+    // Frame t goes out as soon as frame t+lookahead is in, the ring then holds exactly its window
+    int64_t numOut = lastInShow ? getPendingFrames() + data.cols() : std::max<int64_t>(0, mNumPushed + data.cols() - mLookahead) - mNumOutput;
+    Matrix out(mMean.size(), numOut);
+    int64_t outIdx = 0;
+    for (int dataColIdx = 0; dataColIdx < data.cols(); dataColIdx++) {
+        mRing.push(data.col(dataColIdx));
+        mNumPushed++;
+        if (mNumPushed > mLookahead) {
+            normalizeFrame(mRing.frame(mRing.size()-1-mLookahead), out.col(outIdx++));
+            mNumOutput++;
         }
-        mAccum.conservativeResize(mAccum.rows(), mAccum.cols()+1);
-        mAccum.col(mAccum.cols()-1) = data.col(dataColIdx);
     }
-    Matrix padMatrix = mAccum;
-    if (mZeroPadToSize && padMatrix.cols() < mNFrames) {
-        padMatrix.conservativeResizeLike(Matrix::Zero(mAccum.rows(), mNFrames));
+    if (lastInShow) {
+        // No more future frames, the window of the remaining frames only loses its oldest frames
+        while (mNumOutput < mNumPushed) {
+            int64_t windowStart = mNumOutput + mLookahead - (mRing.capacity()-1);
+            while (mNumPushed - mRing.size() < windowStart) mRing.popOldest();
+            normalizeFrame(mRing.frame(mNumOutput - (mNumPushed - mRing.size())), out.col(outIdx++));
+            mNumOutput++;
+        }
+        endOfUtterance();
     }
-    Matrix out = padMatrix.rowwise().sum()/padMatrix.cols();
     return out;
 }
 
@@ -118,10 +229,12 @@ std::string FeatureNormalizerComponent::describeThyself() {
 }
 
 /* FeatureNormalizerComponent::ExtendedDescription
-This normalization component supports 4 different types of "normalization":
+This normalization component supports 5 different types of "normalization":
 
 "covariance:" This builds up a proper covariance matrix (full, or only diagonal) and normalizes the features according to it. The normalization can be selectively be means normalization ("norm_means") and vars, i.e. covariance normalization ("norm_vars"). "decay_num_frames" introduces a "memory decay" through a simple exponential decay
 
+"sliding_window": Per-dimension mean ("norm_means") and variance ("norm_vars") normalization over a window of "sliding_window_frames" frames, i.e. the stats of frames older than that are dropped entirely. "sliding_window_lookahead" moves the end of the window that many frames into the future (0 for a window ending at the current frame), e.g. half the window size for a centered window. The output is then delayed by that many frames. At the end of the utterance the remaining frames get normalized with what is left of their window
+
 "L2": Normalize each feature column vector with its L2 norm
 
 "n_frame_average": Maybe not really "normalization", but it combines n frames (from "update_stats_every_n_frames") into one averaged output vector. So, it produces one output vector every n input vectors. "zero_pad_input_to_n_frames" specifies if for the case of to little data at the very end (i.e. < N frames), whether to zero-pad it to N frames, or rather averages over the frames we have.
@@ -147,7 +260,7 @@ FeatureNormalizerComponent::FeatureNormalizerComponent(std::string id, Component
         mAccumFeats = Matrix(0,0);
     }
 
-    std::string normalizationTypeString = configPt->get<std::string>("normalization_type", "Normalization type (covariance, log_limiter, L2, n_frame_average)");
+    std::string normalizationTypeString = configPt->get<std::string>("normalization_type", "Normalization type (covariance, sliding_window, log_limiter, L2, n_frame_average)");
     if (normalizationTypeString == "covariance") {
         bool normalizeMeans = configPt->get<bool>("norm_means", "Normalize means");
         bool normalizeVariances = configPt->get<bool>("norm_vars", "Normalize variances");
@@ -162,6 +275,12 @@ FeatureNormalizerComponent::FeatureNormalizerComponent(std::string id, Component
         int64_t decayNumFrames = configPt->get<int64_t>("decay_num_frames", "Frame window size for 1/e dropoff of memory (set <= 0 for infinite memory)");
         float decayFactor = decayNumFrames <= 0 ? 1.0f : exp(-1.0f / (float)decayNumFrames);
         normalizer = boost::shared_ptr<AccumCovarianceNormalizer>(new AccumCovarianceNormalizer(mExpectedFeatureSize, covarType, normalizeMeans, normalizeVariances, decayFactor));
+    } else if (normalizationTypeString == "sliding_window") {
+        bool normalizeMeans = configPt->get<bool>("norm_means", "Normalize means");
+        bool normalizeVariances = configPt->get<bool>("norm_vars", "Normalize variances");
+        int64_t windowSize = configPt->get<int64_t>("sliding_window_frames", "Size of the sliding normalization window, in frames");
+        int64_t lookahead = configPt->get<int64_t>("sliding_window_lookahead", "How many frames the sliding window reaches into the future (0 for a window ending at the current frame). The output is delayed by that many frames");
+        normalizer = boost::shared_ptr<SlidingWindowNormalizer>(new SlidingWindowNormalizer(mExpectedFeatureSize, windowSize, lookahead, normalizeMeans, normalizeVariances));
     } else if (normalizationTypeString == "log_limiter") {
         normalizer = boost::shared_ptr<LogLimiter>(new LogLimiter(mExpectedFeatureSize));
     } else if (normalizationTypeString == "L2") {
@@ -199,24 +318,30 @@ void FeatureNormalizerComponent::ProcessMessage(const DecoderMessageBlock& msgBl
         mAccumFeats.rightCols(m.cols()) = m;
         std::vector<uint64_t> featureTimestamps;
         Matrix normM = Matrix(mAccumFeats.rows(), 0);
-        while(mAccumFeats.cols() / mUpdateStatsHop > 0 || (mAccumFeats.cols() > 0 && convStateMsg->mLastChunkInUtt)) {
+        // The timestamps buffer first holds the frames the normalizer has taken in but not output yet, then those in mAccumFeats
+        while(mAccumFeats.cols() / mUpdateStatsHop > 0 || (convStateMsg->mLastChunkInUtt && (mAccumFeats.cols() > 0 || normalizer->getPendingFrames() > 0))) {
             int pickupToCol = (std::min((int)mUpdateStatsHop, (int)mAccumFeats.cols()));
+            bool lastInShow = convStateMsg->mLastChunkInUtt && pickupToCol == mAccumFeats.cols();
             Matrix subMatrix = mAccumFeats.block(0, 0, mAccumFeats.rows(), pickupToCol);
+            int64_t inFrames = normalizer->getPendingFrames() + pickupToCol;
 
-            normalizer->previewData(subMatrix, convStateMsg->mLastChunkInUtt);
-            Matrix normSubMatrix = normalizer->transform(subMatrix, convStateMsg->mLastChunkInUtt);
+            normalizer->previewData(subMatrix, lastInShow);
+            Matrix normSubMatrix = normalizer->transform(subMatrix, lastInShow);
+            int64_t consumedFrames = inFrames - normalizer->getPendingFrames();
 
-            normM.conservativeResize(normM.rows(), normM.cols()+normSubMatrix.cols());
-            normM.rightCols(normSubMatrix.cols()) = normSubMatrix;
+            if (normSubMatrix.cols() > 0) {
+                normM.conservativeResize(normM.rows(), normM.cols()+normSubMatrix.cols());
+                normM.rightCols(normSubMatrix.cols()) = normSubMatrix;
 
-            if (subMatrix.cols() % normSubMatrix.cols() != 0) GODEC_ERR << getLPId() << ": The features going into the normalizer are not an integer multiple of the number of features coming out. Impossible to choose the right timestamps";
-            for(int timeIdx = 0; timeIdx < normSubMatrix.cols(); timeIdx++) {
-                featureTimestamps.push_back(mFeatureTimestampsBuffer[(timeIdx+1)*(subMatrix.cols()/normSubMatrix.cols())-1]);
+                if (consumedFrames % normSubMatrix.cols() != 0) GODEC_ERR << getLPId() << ": The features going into the normalizer are not an integer multiple of the number of features coming out. Impossible to choose the right timestamps";
+                for(int timeIdx = 0; timeIdx < normSubMatrix.cols(); timeIdx++) {
+                    featureTimestamps.push_back(mFeatureTimestampsBuffer[(timeIdx+1)*(consumedFrames/normSubMatrix.cols())-1]);
+                }
             }
 
             mAccumFeats = (Matrix)mAccumFeats.rightCols(mAccumFeats.cols()-pickupToCol);
             mFeatureTimestampsBuffer.erase(mFeatureTimestampsBuffer.begin(),
-                                           mFeatureTimestampsBuffer.begin() + pickupToCol);
+                                           mFeatureTimestampsBuffer.begin() + consumedFrames);
         }
 
         if (normM.cols() > 0) {
@@ -11,12 +11,38 @@ class Normalizer {
     virtual Matrix transform(const Matrix& data, bool lastInShow) = 0;
     virtual void endOfUtterance() = 0;
     virtual void endOfConvo() = 0;
+    // Number of input frames transform() has taken in but not output yet (because it needs lookahead). They get flushed when lastInShow is set
+    virtual int64_t getPendingFrames() const { return 0; }
+};
+
+// Fixed-capacity ring of the last N feature frames. With "keepSums" it also keeps running (double) sums of the frames and their squares. Adding and removing frames leaves rounding residue in the sums, so they get recomputed from the held frames every time the oldest frame wraps around the ring
+class FrameRingBuffer {
+  public:
+    FrameRingBuffer(int64_t vectorSize, int64_t capacity, bool keepSums);
+    // When full, the oldest frame is dropped
+    void push(const Eigen::Ref<const Vector>& frame);
+    void popOldest();
+    void clear();
+    int64_t size() const { return mSize; }
+    int64_t capacity() const { return mFrames.cols(); }
+    // idx 0 is the oldest frame
+    Matrix::ConstColXpr frame(int64_t idx) const { return mFrames.col((mOldest + idx) % capacity()); }
+    const Eigen::VectorXd& getSum() const { return mSum; }
+    const Eigen::VectorXd& getSumSquares() const { return mSumSquares; }
+  private:
+    void recomputeSums();
+    Matrix mFrames;
+    int64_t mOldest;
+    int64_t mSize;
+    bool mKeepSums;
+    Eigen::VectorXd mSum;
+    Eigen::VectorXd mSumSquares;
 };
 
 class NFrameAverager : public Normalizer {
-  Matrix mAccum;
-  int64_t mNFrames;
-  bool mZeroPadToSize;
+    FrameRingBuffer mRing;
+    bool mZeroPadToSize;
+    Matrix mOrderedFrames; // The ring's frames oldest first, zero beyond the ring size
   public:
     NFrameAverager(int64_t nFrames, int64_t vectorSize, bool zeroPadToSize);
     virtual ~NFrameAverager();
@@ -47,6 +73,27 @@ class LogLimiter : public Normalizer {
     void endOfConvo();
 };
 
+// Mean/variance normalization over a sliding window of the last N frames, the window can reach "lookahead" frames into the future, at the cost of that much latency
+class SlidingWindowNormalizer : public Normalizer {
+    FrameRingBuffer mRing;
+    int64_t mLookahead;
+    bool mNormMean;
+    bool mNormVar;
+    int64_t mNumPushed; // Frames pushed into the ring since the utterance start
+    int64_t mNumOutput;
+    Eigen::VectorXd mMean;
+    Eigen::VectorXd mInvStdDev;
+    void normalizeFrame(const Eigen::Ref<const Vector>& frame, Eigen::Ref<Vector> out);
+  public:
+    SlidingWindowNormalizer(int vectorSize, int64_t windowSize, int64_t lookahead, bool normMean, bool normVar);
+    virtual ~SlidingWindowNormalizer();
+    void previewData(const Matrix& data, bool lastInShow);
+    Matrix transform(const Matrix& data, bool lastInShow);
+    void endOfUtterance();
+    void endOfConvo();
+    int64_t getPendingFrames() const { return mNumPushed - mNumOutput; }
+};
+
 class AccumCovarianceNormalizer : public Normalizer {
     boost::shared_ptr<AccumCovariance> onlVariance;
   public:
@@ -9,6 +9,9 @@
 #include <chrono>
 #include <thread>
 #include <iomanip>
+#ifndef _MSC_VER
+#include <sys/mman.h>
+#endif
 
 namespace Godec {
 
@@ -46,39 +49,75 @@ int64_t AudioFileReader::getTotalNumSamples() {
     return fileSize / (numChannels*bytesPerSample);
 }
 
-void AudioFileReader::readData(std::vector<unsigned char>& audioData, int64_t beginSample, int64_t& endSample, std::vector<int> channels) {
-    int64_t segmentBeginBytes = numChannels*bytesPerSample*beginSample;
-    // int64_t segmentEndBytes = numChannels*bytesPerSample*endSample;
-
-    int64_t numSamples = (endSample - beginSample);
-    int64_t allChannelsTmpAudioSize = numSamples*numChannels*bytesPerSample;
-    unsigned char* allChannelsTmpAudio = new unsigned char[allChannelsTmpAudioSize];
-
-    fseek(fPtr, (int64_t)(headerSize + segmentBeginBytes), SEEK_SET);
-    int64_t actuallyReadBytes = fread(allChannelsTmpAudio, 1, allChannelsTmpAudioSize, fPtr);
+// Copies the selected channels out of the interleaved audio. The sample size is a compile-time constant here so the copies turn into plain loads/stores the compiler can vectorize
+template<typename T>
+static void deinterleaveChannels(const unsigned char* in, unsigned char* out, int64_t numSamples, int numChannels, const std::vector<int>& channels) {
+    const int64_t inStride = numChannels*sizeof(T);
+    const int64_t outStride = channels.size()*sizeof(T);
+    for(int channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
+        const unsigned char* inRunner = in + (channels[channelIdx] - 1)*sizeof(T);
+        unsigned char* outRunner = out + channelIdx*sizeof(T);
+        for (int64_t sampleIdx = 0; sampleIdx < numSamples; sampleIdx++) {
+            T sample;
+            memcpy(&sample, inRunner + sampleIdx*inStride, sizeof(T));
+            memcpy(outRunner + sampleIdx*outStride, &sample, sizeof(T));
+        }
+    }
+}
 
-    if (actuallyReadBytes != allChannelsTmpAudioSize) {
-        //printf("Sample request beyond end of file! Only read to position %li\n", ftell(fPtr));
-        numSamples = actuallyReadBytes / (numChannels*bytesPerSample);
+void AudioFileReader::readData(std::vector<unsigned char>& audioData, int64_t beginSample, int64_t& endSample, const std::vector<int>& channels) {
+    for(int channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
+        if (channels[channelIdx] < 1 || channels[channelIdx] > numChannels) GODEC_ERR << "Requested channel " << channels[channelIdx] << ", but audio file only has " << numChannels << " channel(s)";
+    }
+    int64_t numSamples = std::max((int64_t)0, std::min(endSample, getTotalNumSamples()) - beginSample);
+    if (beginSample + numSamples != endSample) {
+        //printf("Sample request beyond end of file!\n");
         endSample = beginSample+numSamples;
     }
 
     audioData.resize(numSamples*bytesPerSample*channels.size());
-
-    for (int64_t sampleIdx = 0; sampleIdx < numSamples; sampleIdx++) {
-        for(int channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
-            int channel = channels[channelIdx];
-            int64_t readPosition = bytesPerSample*(numChannels*sampleIdx + (channel - 1));
-            int64_t writePos = sampleIdx*bytesPerSample*channels.size()+channelIdx*bytesPerSample;
-            memcpy(&audioData[writePos], allChannelsTmpAudio + readPosition, bytesPerSample);
+    if (numSamples == 0) return;
+    const unsigned char* segmentBegin = (const unsigned char*)mappedFile.data() + headerSize + numChannels*bytesPerSample*beginSample;
+
+    bool allChannelsInOrder = channels.size() == numChannels;
+    for(int channelIdx = 0; channelIdx < channels.size(); channelIdx++) allChannelsInOrder = allChannelsInOrder && (channels[channelIdx] == channelIdx + 1);
+
+    if (allChannelsInOrder) {
+        memcpy(&audioData[0], segmentBegin, audioData.size());
+    } else if (bytesPerSample == 1) {
+        deinterleaveChannels<uint8_t>(segmentBegin, &audioData[0], numSamples, numChannels, channels);
+    } else if (bytesPerSample == 2) {
+        deinterleaveChannels<uint16_t>(segmentBegin, &audioData[0], numSamples, numChannels, channels);
+    } else if (bytesPerSample == 4) {
+        deinterleaveChannels<uint32_t>(segmentBegin, &audioData[0], numSamples, numChannels, channels);
+    } else {
+        for (int64_t sampleIdx = 0; sampleIdx < numSamples; sampleIdx++) {
+            for(int channelIdx = 0; channelIdx < channels.size(); channelIdx++) {
+                int channel = channels[channelIdx];
+                int64_t readPosition = bytesPerSample*(numChannels*sampleIdx + (channel - 1));
+                int64_t writePos = sampleIdx*bytesPerSample*channels.size()+channelIdx*bytesPerSample;
+                memcpy(&audioData[writePos], segmentBegin + readPosition, bytesPerSample);
+            }
         }
     }
+}
 
-    delete[](allChannelsTmpAudio);
+void AudioFileReader::mapFile(std::string fileName) {
+    try {
+        mappedFile.open(fileName);
+    } catch (const std::exception& e) {
+        GODEC_ERR << "Failed to map audio file " << fileName << ": " << e.what();
+    }
+    // Only count what is actually there, in case the header says otherwise
+    fileSize = std::max((int64_t)0, std::min(fileSize, (int64_t)mappedFile.size() - headerSize));
+#ifndef _MSC_VER
+    // Segments get read front to back, so let the kernel read ahead aggressively
+    madvise((void*)mappedFile.data(), mappedFile.size(), MADV_SEQUENTIAL);
+#endif
 }
 
 void AudioFileReader::close() {
-    fclose(fPtr);
+    mappedFile.close();
 }
 
 AudioFileReader *openWaveFile(std::string fileName) {
@@ -135,7 +174,8 @@ AudioFileReader *openWaveFile(std::string fileName) {
         } else if (strncmp(&buffer[0],"data",strlen("data")) == 0) {
             outFR->headerSize = ftell(f);
             outFR->fileSize = statBuf.st_size - outFR->headerSize;
-            outFR->fPtr = f;
+            fclose(f);
+            outFR->mapFile(fileName);
             return outFR;
         } else {
             GODEC_ERR << "Unknown chunk type " << buffer[0] << buffer[1] << buffer[2] << buffer[3] << " in audio file";
@@ -196,13 +236,24 @@ AudioFileReader *openNIST1AFile(std::string fileName) {
     } while (strcmp(nistFileLine, "end_head") != 0);
 
     outFR->fileSize = statBuf.st_size - headerSize;
-    outFR->fPtr = f;
     outFR->headerSize = headerSize;
-    fseek(f, outFR->headerSize, SEEK_SET);
+    fclose(f);
+    outFR->mapFile(fileName);
 
     return outFR;
 }
 
+// The shards are consecutive blocks, so concatenating their outputs in shard order gives the same order as an unsharded run. If episodes are given, the shard boundaries get moved so they don't split one
+static void GetShardRange(int64_t numItems, int numShards, int shardIndex, const std::vector<std::string>* episodes, int64_t& shardBegin, int64_t& shardEnd) {
+    auto boundary = [&](int shard) {
+        int64_t b = numItems*shard/numShards;
+        while (episodes != nullptr && b > 0 && b < numItems && (*episodes)[b] == (*episodes)[b-1]) b++;
+        return b;
+    };
+    shardBegin = boundary(shardIndex);
+    shardEnd = boundary(shardIndex+1);
+}
+
 void parseAnalistLine(std::string& analistFileLine, std::string& waveFile, std::vector<int>& channels, std::string& typeString, int64_t& beginSample, int64_t& endSample, double& stretch, std::string& utteranceId, std::string& episodeName) {
     boost::algorithm::trim_right(analistFileLine);
 
@@ -252,7 +303,7 @@ void parseAnalistLine(std::string& analistFileLine, std::string& waveFile, std::
 }
 
 
-AnalistFileFeeder::AnalistFileFeeder(std::string analistFile, std::string _waveFileDir, std::string _waveFileExtension) {
+AnalistFileFeeder::AnalistFileFeeder(std::string analistFile, std::string _waveFileDir, std::string _waveFileExtension, int numShards, int shardIndex) {
     mWaveFileDir = _waveFileDir;
     mWaveFileExtension = _waveFileExtension;
     fflush(stdout);
@@ -275,10 +326,26 @@ AnalistFileFeeder::AnalistFileFeeder(std::string analistFile, std::string _waveF
     }
     fseek(mListFileFp, 0, SEEK_SET);
 
-    utteranceCounter = 0;
+    int64_t shardBegin, shardEnd;
+    GetShardRange(episodeList.size(), numShards, shardIndex, &episodeList, shardBegin, shardEnd);
+    // Skipped lines still count, so the utterance IDs are the same as without sharding
+    for (utteranceCounter = 0; utteranceCounter < shardBegin; utteranceCounter++) {
+        if (!fgets(analistFileLine, 1000, mListFileFp)) break;
+    }
+    mShardEnd = shardEnd;
+    mCurrentReader = NULL;
+}
+
+AnalistFileFeeder::~AnalistFileFeeder() {
+    if (mCurrentReader != NULL) {
+        mCurrentReader->close();
+        delete mCurrentReader;
+    }
+    fclose(mListFileFp);
 }
 
 bool AnalistFileFeeder::getNextUtterance(std::vector<unsigned char>& audioData, int& sampleWidth, std::string& utteranceId, std::string& episodeName, bool& episodeDone, bool& fileDone, std::string& waveFile, std::vector<int>& channels, std::string& formatString, float& audioChunkTimeInSeconds, int64_t& beginSample, float& uttOffsetInFileInSeconds) {
+    if (utteranceCounter >= mShardEnd) return false;
     utteranceCounter++;
     utteranceId = std::to_string(utteranceCounter);
     episodeDone = false;
@@ -296,18 +363,27 @@ bool AnalistFileFeeder::getNextUtterance(std::vector<unsigned char>& audioData,
 
         std::string fullWavePath = mWaveFileDir+"/"+waveFile+"."+mWaveFileExtension;
 
-        AudioFileReader* reader = NULL;
-        std::string baseFormat = "";
-        if (typeString == "WAV") {
-            reader = openWaveFile(fullWavePath);
-        } else if (typeString == "NIST_1A") {
-            reader = openNIST1AFile(fullWavePath);
-        } else {
-            GODEC_ERR << "Unknown type '" << typeString << "'";
-        }
-        if (reader == NULL) {
-            GODEC_ERR << "Couldn't open file " << fullWavePath;
+        if (mCurrentReader == NULL || fullWavePath != mCurrentReaderFile || typeString != mCurrentReaderType) {
+            if (mCurrentReader != NULL) {
+                mCurrentReader->close();
+                delete mCurrentReader;
+                mCurrentReader = NULL;
+            }
+            if (typeString == "WAV") {
+                mCurrentReader = openWaveFile(fullWavePath);
+            } else if (typeString == "NIST_1A") {
+                mCurrentReader = openNIST1AFile(fullWavePath);
+            } else {
+                GODEC_ERR << "Unknown type '" << typeString << "'";
+            }
+            if (mCurrentReader == NULL) {
+                GODEC_ERR << "Couldn't open file " << fullWavePath;
+            }
+            mCurrentReaderFile = fullWavePath;
+            mCurrentReaderType = typeString;
         }
+        AudioFileReader* reader = mCurrentReader;
+        std::string baseFormat = "";
 
         if (reader->audioType == PCM) baseFormat = "PCM";
         else if (reader->audioType == MuLaw) baseFormat = "ulaw";
@@ -320,80 +396,171 @@ bool AnalistFileFeeder::getNextUtterance(std::vector<unsigned char>& audioData,
         reader->readData(audioData, beginSample, endSample, channels);
         audioChunkTimeInSeconds = audioData.size() /((float)channels.size()*reader->samplingFrequency*reader->bytesPerSample);
         uttOffsetInFileInSeconds = beginSample/(float)reader->samplingFrequency;
-        reader->close();
-        delete reader;
 
-        fileDone = isEndOfFile(mListFileFp);
+        fileDone = utteranceCounter == mShardEnd || isEndOfFile(mListFileFp);
     } else return false;
 
     return true;
 }
 
-TextFileFeeder::TextFileFeeder(const std::string& text_file) {
+TextFileFeeder::TextFileFeeder(const std::string& text_file, int numShards, int shardIndex) {
     lineCounter = 0;
+    mShardEnd = INT64_MAX;
     text_reader.open(text_file, std::ifstream::in | std::ifstream::binary);
+    if (numShards > 1) {
+        std::string line;
+        int64_t numLines = 0;
+        while (!isEndOfFile(text_reader)) {
+            std::getline(text_reader, line);
+            numLines++;
+        }
+        text_reader.clear();
+        text_reader.seekg(0);
+        int64_t shardBegin;
+        GetShardRange(numLines, numShards, shardIndex, nullptr, shardBegin, mShardEnd);
+        for (; lineCounter < shardBegin; lineCounter++) std::getline(text_reader, line);
+    }
 }
 
 TextFileFeeder::~TextFileFeeder() {
 }
 
 bool TextFileFeeder::getNextUtterance(std::string& utteranceId, std::string& text, bool &fileDone) {
-    if (isEndOfFile(text_reader)) {
+    if (lineCounter >= mShardEnd || isEndOfFile(text_reader)) {
         return false;
     } else {
         std::getline(text_reader, text);
         lineCounter++;
         utteranceId = (boost::format("text_line_%1%") % lineCounter).str();
-        fileDone = isEndOfFile(text_reader);
+        fileDone = lineCounter == mShardEnd || isEndOfFile(text_reader);
         return true;
     }
 }
 
-JsonFileFeeder::JsonFileFeeder(const std::string& jsonFile) {
+JsonFileFeeder::JsonFileFeeder(const std::string& jsonFile, bool jsonLines) {
     itemCounter = 0;
-    std::ifstream is(jsonFile);
-    if (!is) {
+    mJsonFile = jsonFile;
+    mJsonLines = jsonLines;
+    mArrayDone = false;
+    mJsonStream.open(jsonFile, std::ios::binary);
+    if (!mJsonStream) {
         GODEC_ERR << "Fail to open file '" << jsonFile << "' for reading." << std::endl;
 
     }
-    try {
-        is >> jsonData;
-    } catch(json::parse_error& e) {
-        GODEC_ERR << "Fail to load JSON data from '" << jsonFile << "'. " << e.what() << std::endl;
-    }
-
-    if (!jsonData.is_array()) {
+    if (!mJsonLines && nextNonSpace() != '[') {
         GODEC_ERR << "Toplevel JSON data must be an array." << std::endl;
     }
 }
 
-bool JsonFileFeeder::getNextMessage(json &jsonMessage, json &jsonConvState) {
-    if (itemCounter < jsonData.size()) {
-        json jsonObj = jsonData[itemCounter++];
+int JsonFileFeeder::nextNonSpace() {
+    auto buf = mJsonStream.rdbuf();
+    int c;
+    do {
+        c = buf->sbumpc();
+    } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    return c;
+}
 
-        if (!jsonObj.is_object() || jsonObj.find("json_message") == jsonObj.end() || jsonObj.find("conversation_state") == jsonObj.end()) {
-            GODEC_ERR << "JsonFileFeeder: the " << itemCounter << "-th entry is not a JSON object with 'json_message' and 'conversation_state' fields." << std::endl;
+// Cuts the next top-level element out of the array by tracking bracket depth, without parsing it
+bool JsonFileFeeder::readNextArrayItem(std::string& itemText) {
+    itemText.clear();
+    if (mArrayDone) return false;
+    int c = nextNonSpace();
+    if (itemCounter > 0) {
+        if (c == ']') {
+            mArrayDone = true;
+            return false;
         }
-        jsonMessage = jsonObj["json_message"];
-        jsonConvState = jsonObj["conversation_state"];
-        return true;
-    } else {
+        if (c != ',') GODEC_ERR << "Fail to load JSON data from '" << mJsonFile << "'. Expected ',' or ']' after the " << itemCounter << "-th entry" << std::endl;
+        c = nextNonSpace();
+    } else if (c == ']') {
+        mArrayDone = true;
         return false;
     }
+
+    auto buf = mJsonStream.rdbuf();
+    int depth = 0;
+    bool inString = false;
+    while (c != std::char_traits<char>::eof()) {
+        itemText.push_back((char)c);
+        if (inString) {
+            if (c == '\\') {
+                c = buf->sbumpc();
+                if (c == std::char_traits<char>::eof()) break;
+                itemText.push_back((char)c);
+            } else if (c == '"') {
+                inString = false;
+            }
+        } else if (c == '"') {
+            inString = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+            if (depth == 0) return true;
+        } else if (depth == 0) {
+            // A scalar, which will get rejected below anyway
+            int next = buf->sgetc();
+            if (next == ',' || next == ']' || next == ' ' || next == '\n' || next == '\r' || next == '\t') return true;
+        }
+        c = buf->sbumpc();
+    }
+    GODEC_ERR << "Fail to load JSON data from '" << mJsonFile << "'. Unexpected end of file in the " << (itemCounter+1) << "-th entry" << std::endl;
+    return false;
+}
+
+bool JsonFileFeeder::readNextLine(std::string& itemText) {
+    while (std::getline(mJsonStream, itemText)) {
+        if (itemText.find_first_not_of(" \t\r") != std::string::npos) return true;
+    }
+    return false;
+}
+
+bool JsonFileFeeder::getNextMessage(json &jsonMessage, json &jsonConvState) {
+    bool gotItem = mJsonLines ? readNextLine(mItemText) : readNextArrayItem(mItemText);
+    if (!gotItem) return false;
+    itemCounter++;
+    json jsonObj;
+    try {
+        jsonObj = json::parse(mItemText);
+    } catch(json::parse_error& e) {
+        GODEC_ERR << "Fail to load JSON data from '" << mJsonFile << "', " << itemCounter << "-th entry. " << e.what() << std::endl;
+    }
+
+    if (!jsonObj.is_object() || jsonObj.find("json_message") == jsonObj.end() || jsonObj.find("conversation_state") == jsonObj.end()) {
+        GODEC_ERR << "JsonFileFeeder: the " << itemCounter << "-th entry is not a JSON object with 'json_message' and 'conversation_state' fields." << std::endl;
+    }
+    jsonMessage = std::move(jsonObj["json_message"]);
+    jsonConvState = std::move(jsonObj["conversation_state"]);
+    return true;
 }
 
 JsonFileFeeder::~JsonFileFeeder() {
 }
 
-NumpyFileFeeder::NumpyFileFeeder(std::string npzKeysListFile) {
+NumpyFileFeeder::NumpyFileFeeder(std::string npzKeysListFile, int numShards, int shardIndex) {
     std::ifstream tmpIf(npzKeysListFile);
     mKeysListNumLines = std::count(std::istreambuf_iterator<char>(tmpIf), std::istreambuf_iterator<char>(), '\n');
     mKeysListFile.open(npzKeysListFile);
     if (!mKeysListFile) GODEC_ERR << "Failed to open " << npzKeysListFile;
-    mKeyListFileLineCount = 0;
+    int64_t shardBegin;
+    GetShardRange(mKeysListNumLines, numShards, shardIndex, nullptr, shardBegin, mShardEnd);
+    std::string listLine;
+    for (mKeyListFileLineCount = 0; mKeyListFileLineCount < shardBegin; mKeyListFileLineCount++) mKeysListFile >> listLine;
 }
 
-bool NumpyFileFeeder::getNextUtterance(float*& features, int64_t& numFrames, int& frameLength, std::string& utteranceId, std::string& episodeName, bool& episodeDone, bool& fileDone) {
+template<typename T>
+static void npyToRowMajorFloat(const cnpy::NpyArray& data, int frameLength, int64_t numFrames, float* out) {
+    Eigen::Map<Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > outMatrix(out, frameLength, numFrames);
+    if (data.fortran_order) {
+        outMatrix = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> >(data.data<T>(), frameLength, numFrames).template cast<float>();
+    } else {
+        outMatrix = Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> >(data.data<T>(), frameLength, numFrames).template cast<float>();
+    }
+}
+
+bool NumpyFileFeeder::getNextUtterance(const float*& features, int64_t& numFrames, int& frameLength, boost::shared_ptr<void>& featuresHolder, std::string& utteranceId, std::string& episodeName, bool& episodeDone, bool& fileDone) {
+    if (mKeyListFileLineCount >= mShardEnd) return false;
     std::string listLine;
     mKeysListFile >> listLine;
     mKeyListFileLineCount++;
@@ -404,19 +571,40 @@ bool NumpyFileFeeder::getNextUtterance(float*& features, int64_t& numFrames, int
     if (listLineEls.size() != 2) GODEC_ERR << "npz list file parsing error, line " << mKeyListFileLineCount << ". Format for each line is <npz file name>:<hash key insize npz for features>";
     std::string npzFile = listLineEls[0];
     std::string npzKey = listLineEls[1];
-    cnpy::NpyArray data = cnpy::npz_load(npzFile, npzKey);
+    cnpy::npy_info info;
+    const char* rawData = NULL;
+    cnpy::NpyArray data;
+    try {
+        if (mCurrentNpz == nullptr || mCurrentNpz->name() != npzFile) mCurrentNpz = boost::shared_ptr<cnpy::npz_file>(new cnpy::npz_file(npzFile));
+        rawData = mCurrentNpz->data_ptr(npzKey, info);
+        // Uncompressed float32 can be fed straight out of the mapped file, everything else gets loaded and converted
+        if (rawData == NULL || info.type != 'f' || info.word_size != sizeof(float) || info.fortran_order || ((uintptr_t)rawData % alignof(float)) != 0) {
+            rawData = NULL;
+            data = mCurrentNpz->load(npzKey, info);
+        }
+    } catch (const std::runtime_error& e) {
+        GODEC_ERR << "Failed to read npz entry '" << npzKey << "' from " << npzFile << ": " << e.what();
+    }
 
-    if (data.shape.size() != 2) GODEC_ERR << "npz entry '" << npzKey << "' in file " << npzFile << " is not two-dimensional! Don't know how to feed";
-    numFrames = data.shape[1];
-    frameLength = data.shape[0];
-    Eigen::MatrixXd doubleMatrix = Eigen::Map<Eigen::MatrixXd>(data.data<double>(), numFrames, frameLength);
-    mCurrentFeatures = doubleMatrix.cast<float>().transpose();
+    if (info.shape.size() != 2) GODEC_ERR << "npz entry '" << npzKey << "' in file " << npzFile << " is not two-dimensional! Don't know how to feed";
+    frameLength = info.shape[0];
+    numFrames = info.shape[1];
+    if (rawData != NULL) {
+        features = (const float*)rawData;
+        featuresHolder = mCurrentNpz;
+    } else {
+        auto converted = boost::shared_ptr<std::vector<float> >(new std::vector<float>(data.num_vals));
+        if (info.type == 'f' && info.word_size == sizeof(float)) npyToRowMajorFloat<float>(data, frameLength, numFrames, converted->data());
+        else if (info.type == 'f' && info.word_size == sizeof(double)) npyToRowMajorFloat<double>(data, frameLength, numFrames, converted->data());
+        else GODEC_ERR << "npz entry '" << npzKey << "' in file " << npzFile << " is neither float32 nor float64";
+        features = converted->data();
+        featuresHolder = converted;
+    }
 
-    features = mCurrentFeatures.data();
     utteranceId = npzKey;
     episodeName = "dummy";
-    episodeDone = mKeyListFileLineCount == mKeysListNumLines;
-    fileDone = mKeysListFile.eof();
+    episodeDone = mKeyListFileLineCount == mShardEnd;
+    fileDone = episodeDone || mKeysListFile.eof();
     return true;
 }
 
@@ -430,13 +618,19 @@ std::string FileFeederComponent::describeThyself() {
 /* FileFeederComponent::ExtendedDescription
 This is the component for providing your Godec graph with data for processing. The different feeding formats in details:
 
-"analist": A text file describing line-by-line segments in audio file (support formats: WAV and NIST_1A, i.e. SPHERE). The general format is "\<wave file base name without extension\> -c \<channel number, 1-based\> -t \<audio format\> -f \<sample start\>-\<sample end\> -o \<utterance ID\> -spkr \<speaker ID\>" . "wave_dir" parameter specifies the direction of where to find the wave files, "wave_extension" the file extension. The "feed_realtime_factor" specifies how much faster than realtime it should feed the audio (higher value = faster)
+"analist": A text file describing line-by-line segments in audio file (support formats: WAV and NIST_1A, i.e. SPHERE). The general format is "\<wave file base name without extension\> -c \<channel number, 1-based\> -t \<audio format\> -f \<sample start\>-\<sample end\> -o \<utterance ID\> -spkr \<speaker ID\>" . "wave_dir" parameter specifies the direction of where to find the wave files, "wave_extension" the file extension. The "feed_realtime_factor" specifies how much faster than realtime it should feed the audio (higher value = faster). The pacing follows one schedule (on a monotonic clock) for the whole input, chunks that went out late get caught up on. With "verbose" on, the actually achieved rate gets logged at the end. For load testing, "feed_jitter_ms" additionally delays each chunk by a random 0 to "feed_jitter_ms" milliseconds, the way a real soundcard would deliver them (0 for no jitter)
 
 "text": A simple line-by-line file with text in it. The component will feed one line at a time, as a BinaryDecoderMessage with timestamps according to how many words were in the line
 
-"json": A single file containing a JSON array of items. Each item will be pushed as a JsonDecoderMessage
+"json": A single file containing a JSON array of items. Each item will be pushed as a JsonDecoderMessage. The items get read one by one as they are fed, so the file never has to fit into memory as a whole
+
+"json_lines": Same as "json", but the file contains one item per line (JSON Lines) instead of an array
+
+"numpy_npz": A Python Numpy npz file. The parameter "keys_list_file" specifies a file which contains a line-by-line list of npz+key combo, e.g. "my_feats.npz:a", which would extract key "a" from my_feats.npz. "feature_chunk_size" sets the size of the feature chunks to be pushed. The arrays can be float32 or float64, uncompressed float32 ones (i.e. saved with numpy.savez) are the fastest to feed
 
-"numpy_npz": A Python Numpy npz file. The parameter "keys_list_file" specifies a file which contains a line-by-line list of npz+key combo, e.g. "my_feats.npz:a", which would extract key "a" from my_feats.npz. "feature_chunk_size" sets the size of the feature chunks to be pushed
+Inside a sharded Submodule (see its "shards" parameter), each shard's FileFeeder only feeds one consecutive block of the input list (analist, text and numpy_npz only). With analist, the blocks never split an episode. Utterance IDs are the same as in an unsharded run
+
+While one item is being pushed, the next ones get read on a background thread. The optional "prefetch_depth" parameter sets how many items are read ahead (default 2, 0 reads inline), "prefetch_max_bytes" caps the memory they take up (default 256MB, a single item always gets through)
 
 The "control_type" parameter describes whether the FileFeeder will just work off one single configuration on startup, i.e. batch processing ("single_on_startup"), or whether it should receive these configurations via an external slot ("external") that pushes the exact same component JSON configuration from the outside via the Java API. The latter is essentially for "dynamic batch processing" where the FileFeeder gets pointed to new data dynamically.
 
@@ -444,15 +638,23 @@ The "control_type" parameter describes whether the FileFeeder will just work off
 
 boost::shared_ptr<FileFeederHolder> FileFeederComponent::GetFileFeederFromConfig( ComponentGraphConfig* configPt) {
     auto ffh = boost::shared_ptr<FileFeederHolder>(new FileFeederHolder());
-    std::string sourceType = configPt->get<std::string>("source_type", "File type of source file (analist, text, numpy_npz, json)");
+    std::string sourceType = configPt->get<std::string>("source_type", "File type of source file (analist, text, numpy_npz, json, json_lines)");
     std::string inputFile;
     if (sourceType != "numpy_npz") {
         inputFile = configPt->get<std::string>("input_file", "Input file");
     }
     ffh->inputFile = inputFile;
 
+    // Inside a sharded Submodule, only this shard's block of the input list gets fed
+    ffh->mNumShards = configPt->globalVals.get<int>(LoopProcessor::NumShards);
+    ffh->mShardIndex = configPt->globalVals.get<int>(LoopProcessor::ShardIndex);
+    if (ffh->mNumShards > 1 && sourceType != "analist" && sourceType != "text" && sourceType != "numpy_npz") GODEC_ERR << "Sharding is only supported for analist, text and numpy_npz sources";
+
     if (sourceType == "analist") {
         ffh->mFeedRealtimeFactor = configPt->get<float>("feed_realtime_factor", "Controls how fast the audio is pushed. A value of 1.0 simulates soundcard reading of audio (i.e. pushing a 1-second chunk takes 1 second), a higher value pushes faster. Use 100000 for batch pushing");
+        // For load testing, emulates the irregular delivery of a real soundcard
+        ffh->mFeedJitterMs = configPt->get<int>("feed_jitter_ms", "Random additional delay of each pushed chunk, up to this many milliseconds. For emulating soundcard delivery during load testing, 0 for none");
+        if (ffh->mFeedJitterMs < 0) GODEC_ERR << "feed_jitter_ms can't be negative";
         boost::filesystem::path waveFileDirPath(configPt->get<std::string>("wave_dir", "Audio waves directory"));
         std::string waveFileDir;
         try {
@@ -465,25 +667,36 @@ boost::shared_ptr<FileFeederHolder> FileFeederComponent::GetFileFeederFromConfig
             GODEC_ERR << "Couldn't find wave_dir '" << waveFileDirPath << "'";
         }
         std::string waveFileExtension = configPt->get<std::string>("wave_extension", "Wave file extension");
-        ffh->analistFileFeeder = new AnalistFileFeeder((char*)inputFile.c_str(), (char*)waveFileDir.c_str(), (char*)waveFileExtension.c_str());
+        ffh->analistFileFeeder = new AnalistFileFeeder((char*)inputFile.c_str(), (char*)waveFileDir.c_str(), (char*)waveFileExtension.c_str(), ffh->mNumShards, ffh->mShardIndex);
         ffh->chunkSizeInSamples = configPt->get<int>("audio_chunk_size", "Audio size in samples for each chunk");
         ffh->mTimeUpsampleFactor = configPt->get<int>("time_upsample_factor", "Factor by which the internal time stamps are increased. This is to prevent multiple subunits having the same time stamp.");
     } else if (sourceType == "text") {
-        ffh->textFileFeeder = new TextFileFeeder(inputFile);
-    } else if (sourceType == "json") {
-        ffh->jsonFileFeeder = new JsonFileFeeder(inputFile);
+        ffh->textFileFeeder = new TextFileFeeder(inputFile, ffh->mNumShards, ffh->mShardIndex);
+    } else if (sourceType == "json" || sourceType == "json_lines") {
+        ffh->jsonFileFeeder = new JsonFileFeeder(inputFile, sourceType == "json_lines");
     } else if (sourceType == "numpy_npz") {
         std::string npzKeysList = configPt->get<std::string>("keys_list_file", "File containing a list (line by line) of keys that are contained in the npz file and are then fed in that order");
-        ffh->numpyFileFeeder = new NumpyFileFeeder(npzKeysList);
+        ffh->numpyFileFeeder = new NumpyFileFeeder(npzKeysList, ffh->mNumShards, ffh->mShardIndex);
         ffh->chunkSizeInFrames = configPt->get<int>("feature_chunk_size", "Size in frames of each pushed chunk");
     } else {
-        GODEC_ERR << "Unknown source type '" << sourceType << "'. Valid options are: analist, text, numpy_mpz, and json." << std::endl;
+        GODEC_ERR << "Unknown source type '" << sourceType << "'. Valid options are: analist, text, numpy_npz, json and json_lines." << std::endl;
+    }
+    // Read-ahead only affects speed, not what gets fed
+    ffh->mPrefetchDepth = 2;
+    if (configPt->get_optional_READ_DECLARATION_BEFORE_USE<int>("prefetch_depth")) {
+        ffh->mPrefetchDepth = configPt->get<int>("prefetch_depth", "How many upcoming items are read ahead on a background thread, 0 for reading them inline (optional, default 2)");
+    }
+    if (ffh->mPrefetchDepth < 0) GODEC_ERR << "prefetch_depth can't be negative";
+    ffh->mPrefetchMaxBytes = 256*1024*1024;
+    if (configPt->get_optional_READ_DECLARATION_BEFORE_USE<int64_t>("prefetch_max_bytes")) {
+        ffh->mPrefetchMaxBytes = configPt->get<int64_t>("prefetch_max_bytes", "Maximum memory, in bytes, of the read-ahead items (optional, default 256MB). A single larger item still gets through");
     }
     return ffh;
 }
 
 FileFeederComponent::FileFeederComponent(std::string id, ComponentGraphConfig* configPt) :
     LoopProcessor(id, configPt) {
+    mPrefetchedBytes = 0;
 
     mFFHChannel.checkIn(getLPId(false));
 
@@ -491,6 +704,7 @@ FileFeederComponent::FileFeederComponent(std::string id, ComponentGraphConfig* c
     if (mControlType == "single_on_startup") {
         mFFHChannel.put(GetFileFeederFromConfig(configPt));
     } else if (mControlType == "external") {
+        if (configPt->globalVals.get<int>(LoopProcessor::NumShards) > 1) GODEC_ERR << getLPId() << ": A FileFeeder inside a sharded Submodule can't be externally controlled";
         addInputSlotAndUUID(SlotControl, UUID_JsonDecoderMessage);
     } else GODEC_ERR << "Unknown control type " << mControlType;
 
@@ -527,6 +741,142 @@ void FileFeederComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
 
 std::string FileFeederComponent::SlotOutput = "output_stream";
 
+bool FileFeederComponent::ReadNextItem(boost::shared_ptr<FileFeederHolder> ffh, boost::shared_ptr<FileFeederItem>& item) {
+    item = boost::shared_ptr<FileFeederItem>(new FileFeederItem());
+    item->features = NULL;
+    item->numFrames = 0;
+    item->frameLength = 0;
+    item->episodeDone = false;
+    item->fileDone = false;
+    item->beginSamples = 0;
+    if (ffh->analistFileFeeder != NULL) {
+        return ffh->analistFileFeeder->getNextUtterance(item->audioData, item->sampleWidth, item->utteranceId, item->episodeName, item->episodeDone, item->fileDone, item->waveFile, item->channels, item->formatString, item->audioChunkTimeInSeconds, item->beginSamples, item->uttOffsetInFileInSeconds);
+    } else if (ffh->numpyFileFeeder != NULL) {
+        return ffh->numpyFileFeeder->getNextUtterance(item->features, item->numFrames, item->frameLength, item->featuresHolder, item->utteranceId, item->episodeName, item->episodeDone, item->fileDone);
+    } else if (ffh->textFileFeeder != NULL) {
+        return ffh->textFileFeeder->getNextUtterance(item->utteranceId, item->text, item->fileDone);
+    } else if (ffh->jsonFileFeeder != NULL) {
+        return ffh->jsonFileFeeder->getNextMessage(item->jsonMessage, item->jsonConvState);
+    }
+    return false;
+}
+
+void FileFeederComponent::PrefetchLoop(boost::shared_ptr<FileFeederHolder> ffh) {
+    try {
+        boost::shared_ptr<FileFeederItem> item;
+        while (ReadNextItem(ffh, item)) {
+            int64_t itemBytes = item->sizeInBytes();
+            {
+                // Always let at least one item through, no matter how big
+                boost::unique_lock<boost::mutex> lock(mPrefetchMutex);
+                mPrefetchCv.wait(lock, [&]() { return mPrefetchedBytes == 0 || mPrefetchedBytes + itemBytes <= ffh->mPrefetchMaxBytes; });
+                mPrefetchedBytes += itemBytes;
+            }
+            mPrefetchChannel.put(item);
+        }
+    } catch (boost::thread_interrupted&) {
+    } catch (...) {
+        mPrefetchException = std::current_exception();
+    }
+    mPrefetchChannel.checkOut(getLPId(false));
+}
+
+void FileFeederComponent::FeedItem(boost::shared_ptr<FileFeederHolder> ffh, boost::shared_ptr<FileFeederItem> item, int64_t& totalTime) {
+    std::vector<unsigned char>& audioData = item->audioData;
+    int sampleWidth = item->sampleWidth;
+    std::string& utteranceId = item->utteranceId;
+    std::string& episodeName = item->episodeName;
+    std::string& waveFile = item->waveFile;
+    std::vector<int>& channels = item->channels;
+    bool episodeDone = item->episodeDone;
+    std::string& text = item->text;
+    std::string& formatString = item->formatString;
+    float audioChunkTimeInSeconds = item->audioChunkTimeInSeconds;
+    float uttOffsetInFileInSeconds = item->uttOffsetInFileInSeconds;
+    json& jsonMessage = item->jsonMessage;
+    json& jsonConvState = item->jsonConvState;
+
+    if (ffh->numpyFileFeeder != NULL) {
+        typedef Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>, 0, Eigen::OuterStride<> > RowMajorFeatures;
+        int64_t nFrames = item->numFrames;
+        int frameLength = item->frameLength;
+        int64_t chunk_size = ffh->chunkSizeInFrames == 0 ? nFrames : ffh->chunkSizeInFrames;
+        const float* feature_runner = item->features;
+        uint64_t remaining_frames = nFrames;
+        while (remaining_frames > 0) {
+            uint64_t chunk_frames = remaining_frames >= chunk_size ? chunk_size : remaining_frames;
+            remaining_frames -= chunk_frames;
+            Matrix featsMatrix = RowMajorFeatures(feature_runner, frameLength, chunk_frames, Eigen::OuterStride<>(nFrames));
+            std::vector<uint64_t> featureTimestamps;
+            for (uint64_t i = 0; i < chunk_frames; ++i) {
+                featureTimestamps.push_back(++totalTime);
+            }
+            bool utt_done = remaining_frames == 0;
+            feature_runner += chunk_frames;
+            boost::format pfname("RAW[0:%1%]%%f");
+            pfname % (frameLength - 1);
+            pushToOutputs(SlotConversationState, ConversationStateDecoderMessage::create(totalTime, utteranceId, utt_done, episodeName, episodeDone&&utt_done));
+            pushToOutputs(SlotOutput, FeaturesDecoderMessage::create(totalTime, utteranceId, featsMatrix, pfname.str(), featureTimestamps));
+        }
+    } else if (audioData.size() != 0) {
+        int64_t audioRunner = 0;
+        if (!ffh->mPacingStarted) {
+            ffh->mPacingStart = std::chrono::steady_clock::now();
+            ffh->mPacingStarted = true;
+        }
+        while (audioRunner < audioData.size()) {
+            int64_t actualIncrement = std::min((int64_t)(audioData.size() - audioRunner), (int64_t)channels.size()*ffh->chunkSizeInSamples*(sampleWidth/8));
+
+            // Like a soundcard, a chunk goes out once all of its audio has "arrived"
+            ffh->mPacedAudioSeconds += audioChunkTimeInSeconds*(actualIncrement/(double)audioData.size());
+            auto targetTime = ffh->mPacingStart+std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(ffh->mPacedAudioSeconds/ffh->mFeedRealtimeFactor));
+            if (ffh->mFeedJitterMs > 0) {
+                // Delivery jitter only delays the individual chunk, it doesn't accumulate
+                std::uniform_int_distribution<int64_t> jitterDist(0, 1000*(int64_t)ffh->mFeedJitterMs);
+                targetTime += std::chrono::microseconds(jitterDist(ffh->mJitterRng));
+            }
+            auto currTime = std::chrono::steady_clock::now();
+            if (targetTime > currTime) {
+                std::this_thread::sleep_until(targetTime);
+            } else {
+                ffh->mMaxPacingLagSeconds = std::max(ffh->mMaxPacingLagSeconds, std::chrono::duration<double>(currTime-targetTime).count());
+            }
+
+            bool isLastInUtt = (audioRunner + actualIncrement) == audioData.size();
+            totalTime += actualIncrement;
+            DecoderMessage_ptr convoMsg = ConversationStateDecoderMessage::create(ffh->mTimeUpsampleFactor*(totalTime+1)-1, utteranceId, isLastInUtt, episodeName, isLastInUtt && episodeDone);
+            pushToOutputs(SlotConversationState, convoMsg);
+
+            std::vector<unsigned char> pushData(audioData.begin() + audioRunner, audioData.begin() + audioRunner + actualIncrement);
+            auto outMsg = BinaryDecoderMessage::create(ffh->mTimeUpsampleFactor*(totalTime + 1) - 1, pushData, formatString);
+            (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("file_feeder_input_file", boost::lexical_cast<std::string>(ffh->inputFile));
+            (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("wave_file_name", waveFile);
+            std::string channelString = boost::algorithm::join( channels | boost::adaptors::transformed( static_cast<std::string(*)(int)>(std::to_string) ), ",");
+            (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("channel", channelString);
+            (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("speaker", episodeName);
+            (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("utterance_offset_in_file", boost::lexical_cast<std::string>(uttOffsetInFileInSeconds));
+
+            pushToOutputs(SlotOutput, outMsg);
+            audioRunner += actualIncrement;
+        }
+    } else if (ffh->textFileFeeder != NULL) {
+        std::vector<std::string> wordVec;
+        boost::split(wordVec, text, boost::is_any_of(" "));
+        totalTime += wordVec.size();
+        pushToOutputs(SlotConversationState, ConversationStateDecoderMessage::create(totalTime, utteranceId, true, episodeName, episodeDone));
+        pushToOutputs(SlotOutput, BinaryDecoderMessage::create(totalTime, String2CharVec(text), "string"));
+    } else if (ffh->jsonFileFeeder != NULL) {
+        totalTime = jsonConvState["time"].get<int64_t>();
+        utteranceId = jsonConvState["utterance_id"].get<std::string>();
+        episodeName = jsonConvState["conversation_id"].get<std::string>();
+        bool endOfUtt = jsonConvState["end_of_utterance"].get<bool>();
+        episodeDone = jsonConvState["end_of_conversation"].get<bool>();
+        pushToOutputs(SlotConversationState, ConversationStateDecoderMessage::create(totalTime, utteranceId, endOfUtt, episodeName, episodeDone));
+        pushToOutputs(SlotOutput, JsonDecoderMessage::create(totalTime, std::move(jsonMessage)));
+
+    }
+}
+
 void FileFeederComponent::FeedLoop() {
     ChannelReturnResult res;
     int64_t totalTime = -1;
@@ -535,106 +885,45 @@ void FileFeederComponent::FeedLoop() {
         res = mFFHChannel.get(ffh, FLT_MAX);
         if (res == ChannelClosed) break;
 
-        std::vector<unsigned char> audioData;
-        int sampleWidth;
-        float* features = NULL;
-        int64_t nFrames = 0;
-        int frameLength = 0;
-        std::string utteranceId;
-        std::string episodeName;
-        std::string waveFile;
-        std::vector<int> channels;
-        std::string ctm_channel;
-        bool episodeDone = false;
-        bool fileDone = false;
-        int64_t beginSamples = 0;
-        std::string text;
-        std::string formatString;
-        float audioChunkTimeInSeconds;
-        float uttOffsetInFileInSeconds;
-        std::vector<std::string> wordStrings;
-        std::vector<std::string> caseStrings;
-        std::vector<std::string> puncStrings;
-        std::vector<float> word_begin_times;
-        std::vector<float> word_dur_times;
-        json jsonMessage;
-        json jsonConvState;
-
-        while (
-            ((ffh->analistFileFeeder != NULL) && (ffh->analistFileFeeder->getNextUtterance(audioData, sampleWidth, utteranceId, episodeName, episodeDone, fileDone, waveFile, channels, formatString, audioChunkTimeInSeconds, beginSamples, uttOffsetInFileInSeconds))) ||
-            ((ffh->numpyFileFeeder != NULL) && (ffh->numpyFileFeeder->getNextUtterance(features, nFrames, frameLength, utteranceId, episodeName, episodeDone, fileDone))) ||
-            ((ffh->textFileFeeder != NULL) && (ffh->textFileFeeder->getNextUtterance(utteranceId, text, fileDone))) ||
-            ((ffh->jsonFileFeeder != NULL) && (ffh->jsonFileFeeder->getNextMessage(jsonMessage, jsonConvState)))
-        ) {
-            if (features != NULL) {
-                int64_t chunk_size = ffh->chunkSizeInFrames == 0 ? nFrames : ffh->chunkSizeInFrames;
-                float * feature_runner = features;
-                uint64_t remaining_frames = nFrames;
-                while (remaining_frames > 0) {
-                    uint64_t chunk_frames = remaining_frames >= chunk_size ? chunk_size : remaining_frames;
-                    remaining_frames -= chunk_frames;
-                    Matrix featsMatrix = Eigen::Map<Matrix>(feature_runner, frameLength, chunk_frames);
-                    std::vector<uint64_t> featureTimestamps;
-                    for (uint64_t i = 0; i < chunk_frames; ++i) {
-                        featureTimestamps.push_back(++totalTime);
-                    }
-                    bool utt_done = remaining_frames == 0;
-                    feature_runner += frameLength*chunk_frames;
-                    boost::format pfname("RAW[0:%1%]%%f");
-                    pfname % (frameLength - 1);
-                    pushToOutputs(SlotConversationState, ConversationStateDecoderMessage::create(totalTime, utteranceId, utt_done, episodeName, episodeDone&&utt_done));
-                    pushToOutputs(SlotOutput, FeaturesDecoderMessage::create(totalTime, utteranceId, featsMatrix, pfname.str(), featureTimestamps));
-                }
-            } else if (audioData.size() != 0) {
-                int64_t audioRunner = 0;
-                auto feedStartTime = std::chrono::system_clock::now();
-                while (audioRunner < audioData.size()) {
-                    int64_t actualIncrement = std::min((int64_t)(audioData.size() - audioRunner), (int64_t)channels.size()*ffh->chunkSizeInSamples*(sampleWidth/8));
-                    float secondsToAdd = audioChunkTimeInSeconds*((audioRunner+actualIncrement)/(float)audioData.size())/ffh->mFeedRealtimeFactor;
-
-                    auto timeToWaitUntil = feedStartTime+std::chrono::milliseconds((int)(1000*secondsToAdd));
-                    auto currTime = std::chrono::system_clock::now();
-                    std::chrono::duration<double> diff = timeToWaitUntil - currTime;
-                    if (diff.count() > 0) {
-                        std::this_thread::sleep_for(std::chrono::duration_cast<std::chrono::milliseconds>(diff));
-                    }
-
-                    bool isLastInUtt = (audioRunner + actualIncrement) == audioData.size();
-                    totalTime += actualIncrement;
-                    DecoderMessage_ptr convoMsg = ConversationStateDecoderMessage::create(ffh->mTimeUpsampleFactor*(totalTime+1)-1, utteranceId, isLastInUtt, episodeName, isLastInUtt && episodeDone);
-                    pushToOutputs(SlotConversationState, convoMsg);
-
-                    std::vector<unsigned char> pushData(audioData.begin() + audioRunner, audioData.begin() + audioRunner + actualIncrement);
-                    auto outMsg = BinaryDecoderMessage::create(ffh->mTimeUpsampleFactor*(totalTime + 1) - 1, pushData, formatString);
-                    (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("file_feeder_input_file", boost::lexical_cast<std::string>(ffh->inputFile));
-                    (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("wave_file_name", waveFile);
-                    std::string channelString = boost::algorithm::join( channels | boost::adaptors::transformed( static_cast<std::string(*)(int)>(std::to_string) ), ",");
-                    (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("channel", channelString);
-                    (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("speaker", episodeName);
-                    (boost::const_pointer_cast<DecoderMessage>(outMsg))->addDescriptor("utterance_offset_in_file", boost::lexical_cast<std::string>(uttOffsetInFileInSeconds));
-
-                    pushToOutputs(SlotOutput, outMsg);
-                    audioRunner += actualIncrement;
-                }
-            } else if (ffh->textFileFeeder != NULL) {
-                std::vector<std::string> wordVec;
-                boost::split(wordVec, text, boost::is_any_of(" "));
-                totalTime += wordVec.size();
-                pushToOutputs(SlotConversationState, ConversationStateDecoderMessage::create(totalTime, utteranceId, true, episodeName, episodeDone));
-                pushToOutputs(SlotOutput, BinaryDecoderMessage::create(totalTime, String2CharVec(text), "string"));
-            } else if (ffh->jsonFileFeeder != NULL) {
-                totalTime = jsonConvState["time"].get<int64_t>();
-                utteranceId = jsonConvState["utterance_id"].get<std::string>();
-                episodeName = jsonConvState["conversation_id"].get<std::string>();
-                bool endOfUtt = jsonConvState["end_of_utterance"].get<bool>();
-                episodeDone = jsonConvState["end_of_conversation"].get<bool>();
-                pushToOutputs(SlotConversationState, ConversationStateDecoderMessage::create(totalTime, utteranceId, endOfUtt, episodeName, episodeDone));
-                pushToOutputs(SlotOutput, JsonDecoderMessage::create(totalTime, jsonMessage));
+        boost::shared_ptr<FileFeederItem> item;
+        if (ffh->mPrefetchDepth == 0) {
+            while (ReadNextItem(ffh, item)) FeedItem(ffh, item, totalTime);
+            ReportPacing(ffh);
+            continue;
+        }
 
+        // Reading happens on a separate thread, so that disk I/O and decoding of the next items overlaps with pushing the current one
+        mPrefetchChannel.setMaxItems(ffh->mPrefetchDepth);
+        mPrefetchedBytes = 0;
+        mPrefetchException = nullptr;
+        mPrefetchChannel.checkIn(getLPId(false));
+        mPrefetchThread = boost::thread(&FileFeederComponent::PrefetchLoop, this, ffh);
+        RegisterThreadForLogging(mPrefetchThread, mLogPtr, isVerbose());
+        try {
+            while (mPrefetchChannel.get(item, FLT_MAX) == ChannelNewItem) {
+                {
+                    boost::unique_lock<boost::mutex> lock(mPrefetchMutex);
+                    mPrefetchedBytes -= item->sizeInBytes();
+                    mPrefetchCv.notify_all();
+                }
+                FeedItem(ffh, item, totalTime);
             }
+        } catch (...) {
+            mPrefetchThread.interrupt();
+            mPrefetchThread.join();
+            throw;
         }
+        mPrefetchThread.join();
+        if (mPrefetchException) std::rethrow_exception(mPrefetchException);
+        ReportPacing(ffh);
     }
     Shutdown();
 }
 
+void FileFeederComponent::ReportPacing(boost::shared_ptr<FileFeederHolder> ffh) {
+    if (!ffh->mPacingStarted) return;
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-ffh->mPacingStart).count();
+    GODEC_INFO << getLPId() << ": Fed " << ffh->mPacedAudioSeconds << "s of audio in " << wallSeconds << "s, i.e. " << (wallSeconds > 0 ? ffh->mPacedAudioSeconds/wallSeconds : 0.0) << "x realtime (target " << ffh->mFeedRealtimeFactor << "x). Max lag behind schedule " << 1000*ffh->mMaxPacingLagSeconds << "ms";
+}
+
 }
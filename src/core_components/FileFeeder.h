@@ -8,6 +8,9 @@
 #include "GodecMessages.h"
 #include "godec/json.hpp"
 #include "cnpy.h"
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <chrono>
+#include <random>
 
 namespace Godec {
 
@@ -17,12 +20,14 @@ enum AudioType {
     Alaw,
 };
 
+// Reads segments out of a memory-mapped audio file. The open*File() functions parse the header, then call mapFile()
 class AudioFileReader {
   public:
-    void readData(std::vector<unsigned char> &audioData, int64_t beginSample, int64_t &endSample, std::vector<int> channels);
+    void readData(std::vector<unsigned char> &audioData, int64_t beginSample, int64_t &endSample, const std::vector<int>& channels);
+    void mapFile(std::string fileName);
     void close();
     int64_t getTotalNumSamples();
-    FILE* fPtr;
+    boost::iostreams::mapped_file_source mappedFile;
     int64_t fileSize;
     float samplingFrequency;
     int numChannels;
@@ -33,7 +38,7 @@ class AudioFileReader {
 
 class AnalistFileFeeder {
   public:
-    AnalistFileFeeder(std::string analistFile, std::string waveFileDir, std::string waveFileExtension);
+    AnalistFileFeeder(std::string analistFile, std::string waveFileDir, std::string waveFileExtension, int numShards, int shardIndex);
     bool getNextUtterance(std::vector<unsigned char> &audioData,
                           int &sampleWidth,
                           std::string &utteranceId,
@@ -46,30 +51,39 @@ class AnalistFileFeeder {
                           float &audioChunkTimeInSeconds,
                           int64_t &beginSample,
                           float &uttOffsetInFileInSeconds);
+    ~AnalistFileFeeder();
   private:
     FILE* mListFileFp;
     std::string mWaveFileDir;
     std::string mWaveFileExtension;
     long utteranceCounter;
+    long mShardEnd;
     std::vector<std::string> episodeList;
+    // Consecutive analist lines usually point into the same file, so the reader is kept open until a different file comes along
+    AudioFileReader* mCurrentReader;
+    std::string mCurrentReaderFile;
+    std::string mCurrentReaderType;
 };
 
 class TextFileFeeder {
   public:
-    TextFileFeeder(const std::string &text_file);
+    TextFileFeeder(const std::string &text_file, int numShards, int shardIndex);
     ~TextFileFeeder();
     bool getNextUtterance(std::string &utteranceId, std::string &text, bool &fileDone);
   private:
     std::ifstream text_reader;
     int32_t lineCounter;
+    int64_t mShardEnd;
 };
 
 class NumpyFileFeeder {
   public:
-    NumpyFileFeeder(std::string npzKeysListFile);
-    bool getNextUtterance(float*&features,
+    NumpyFileFeeder(std::string npzKeysListFile, int numShards, int shardIndex);
+    // The features are row-major frameLength x numFrames, the way they are stored in the npz. featuresHolder keeps them alive
+    bool getNextUtterance(const float*&features,
                           int64_t &numFrames,
                           int &frameLenth,
+                          boost::shared_ptr<void> &featuresHolder,
                           std::string &utteranceId,
                           std::string &episodeName,
                           bool &episodeDone,
@@ -78,19 +92,56 @@ class NumpyFileFeeder {
     std::ifstream mKeysListFile;
     int64_t mKeyListFileLineCount;
     int64_t mKeysListNumLines;
-    Matrix mCurrentFeatures;
+    int64_t mShardEnd;
+    // Consecutive keys usually come from the same npz, so it stays open until a different one comes along
+    boost::shared_ptr<cnpy::npz_file> mCurrentNpz;
 };
 
+// Reads the items one at a time instead of parsing the whole file upfront, so only the current one is in memory
 class JsonFileFeeder {
   public:
-    JsonFileFeeder(const std::string &jsonFile);
+    JsonFileFeeder(const std::string &jsonFile, bool jsonLines);
     ~JsonFileFeeder();
     bool getNextMessage(json &jsonMessage, json &jsonConvState);
   private:
-    json jsonData;
+    bool readNextArrayItem(std::string& itemText);
+    bool readNextLine(std::string& itemText);
+    int nextNonSpace();
+    std::ifstream mJsonStream;
+    std::string mJsonFile;
+    bool mJsonLines;
+    bool mArrayDone;
+    std::string mItemText;
     size_t itemCounter;
 };
 
+// Everything one getNextUtterance()/getNextMessage() call produces, so it can be read ahead of time
+class FileFeederItem {
+  public:
+    int64_t sizeInBytes() { return audioData.size() + numFrames*frameLength*sizeof(float) + text.size(); }
+
+    std::vector<unsigned char> audioData;
+    int sampleWidth;
+    // Row-major, see NumpyFileFeeder
+    const float* features;
+    int64_t numFrames;
+    int frameLength;
+    boost::shared_ptr<void> featuresHolder;
+    std::string utteranceId;
+    std::string episodeName;
+    std::string waveFile;
+    std::vector<int> channels;
+    bool episodeDone;
+    bool fileDone;
+    int64_t beginSamples;
+    std::string text;
+    std::string formatString;
+    float audioChunkTimeInSeconds;
+    float uttOffsetInFileInSeconds;
+    json jsonMessage;
+    json jsonConvState;
+};
+
 class FileFeederHolder {
   public:
     FileFeederHolder() {
@@ -99,6 +150,14 @@ class FileFeederHolder {
         textFileFeeder = nullptr;
         jsonFileFeeder = nullptr;
         mTimeUpsampleFactor = 1;
+        mPrefetchDepth = 0;
+        mPrefetchMaxBytes = 0;
+        mNumShards = 1;
+        mShardIndex = 0;
+        mFeedJitterMs = 0;
+        mPacingStarted = false;
+        mPacedAudioSeconds = 0.0;
+        mMaxPacingLagSeconds = 0.0;
     }
     ~FileFeederHolder() {
         delete numpyFileFeeder;
@@ -117,6 +176,18 @@ class FileFeederHolder {
     float mFeedRealtimeFactor;
     int mTimeUpsampleFactor;
     std::string inputFile;
+    int mPrefetchDepth;
+    int64_t mPrefetchMaxBytes;
+    int mNumShards;
+    int mShardIndex;
+
+    // Audio pacing follows one schedule for the whole run (instead of restarting per utterance), so chunks that went out late get caught up on rather than shifting everything after them
+    int mFeedJitterMs;
+    std::mt19937 mJitterRng;
+    bool mPacingStarted;
+    std::chrono::steady_clock::time_point mPacingStart;
+    double mPacedAudioSeconds;
+    double mMaxPacingLagSeconds;
 };
 
 class FileFeederComponent : public LoopProcessor {
@@ -138,6 +209,18 @@ class FileFeederComponent : public LoopProcessor {
 
     boost::thread mFeedThread;
     void FeedLoop();
+    bool ReadNextItem(boost::shared_ptr<FileFeederHolder> ffh, boost::shared_ptr<FileFeederItem>& item);
+    void PrefetchLoop(boost::shared_ptr<FileFeederHolder> ffh);
+    void FeedItem(boost::shared_ptr<FileFeederHolder> ffh, boost::shared_ptr<FileFeederItem> item, int64_t& totalTime);
+    void ReportPacing(boost::shared_ptr<FileFeederHolder> ffh);
+
+    // Read-ahead of the upcoming items, filled by mPrefetchThread while FeedLoop() pushes the current one
+    channel<boost::shared_ptr<FileFeederItem> > mPrefetchChannel;
+    boost::thread mPrefetchThread;
+    boost::mutex mPrefetchMutex;
+    boost::condition_variable mPrefetchCv;
+    int64_t mPrefetchedBytes;
+    std::exception_ptr mPrefetchException;
 };
 
 }
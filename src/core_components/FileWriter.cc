@@ -1,6 +1,9 @@
 #include "FileWriter.h"
 #include <iomanip>
-#include "cnpy.h"
+#include <limits>
+#include <cmath>
+#include <mutex>
+#include <boost/filesystem.hpp>
 
 namespace Godec {
 
@@ -17,17 +20,272 @@ std::string FileWriterComponent::describeThyself() {
 /* FileWriterComponent::ExtendedDescription
 The writing equivalent to the FileFeeder component, for saving output. Available "input_type":
 
-"audio": For writing AudioDecoderMessage messages. "output_file_prefix" specifies the path prefix that each utterance gets written to. The incoming audio are float values expected to be normalied to -1.0/1.0 range
+"audio": For writing AudioDecoderMessage messages. "output_file_prefix" specifies the path prefix that each utterance gets written to. The incoming audio are float values expected to be normalied to -1.0/1.0 range. "audio_file_format" can be "raw" (headerless samples) or "wav", the latter writes a proper WAV header (with the sizes filled in when the utterance ends)
 
 "raw_text": BinaryDecoderMessage expected that gets converted into text and written into "output_file"
 
 "json": Expects JsonDecoderMessage as input, concatenates the JSONs into the "output_file"
 
-"features": FeatureDecoderMessage as input, output file is a Numpy NPZ file, with the utterance IDs as keys
+"features": FeatureDecoderMessage as input, output file is a Numpy NPZ file, with the utterance IDs as keys. The features get streamed into the file as they come in, the file is complete once the FileWriter shuts down
+
+Inside a sharded Submodule (see its "shards" parameter), each shard writes its "output_file"/"npz_file" to a part file next to it (suffixed with ".shard" and the shard index), which get merged in shard order into the actual file once the last shard is done. Audio output is per utterance anyway and gets written directly
+
+The "raw_text" and "json" output gets written in large blocks by a background thread. Output is flushed at the end of each utterance (audio) or conversation (raw_text, json), and when the FileWriter shuts down. The optional "flush_interval_ms" parameter additionally flushes it periodically, e.g. for watching the files grow
 
 Like the FileFeeder, the "control_type" specifies whether this is a one-shot run that goes straight off the JSON parameters ("single_on_startup"), or whether it receives these JSON parameters through an external channel ("external"). When in the external mode, it also requires the ConversationState stream from the FileFeeder that produced the content
 */
 
+// Clamps and scales the whole chunk into the reusable output buffer in one go, which Eigen vectorizes
+template<typename T>
+static void ConvertAudioSamples(const Vector& audio, std::vector<unsigned char>& buffer) {
+    const float scale = (float)std::numeric_limits<T>::max();
+    // For 32 bit, INT32_MAX rounds up to 2^31 as a float, which doesn't fit back into the integer
+    const float maxScaled = (double)scale > (double)std::numeric_limits<T>::max() ? std::nextafter(scale, 0.0f) : scale;
+    buffer.resize(audio.size()*sizeof(T));
+    Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, 1> > out(reinterpret_cast<T*>(buffer.data()), audio.size());
+    out = (audio.cwiseMin(1.0f).cwiseMax(-1.0f)*scale).cwiseMin(maxScaled).template cast<T>();
+}
+
+static void AppendLE(std::vector<unsigned char>& out, uint32_t val, int numBytes) {
+    for (int idx = 0; idx < numBytes; idx++) out.push_back((unsigned char)((val >> (8*idx)) & 0xff));
+}
+
+static std::vector<unsigned char> CreateWavHeader(uint32_t sampleRate, int sampleDepth, int64_t dataBytes) {
+    uint32_t dataSize = (uint32_t)std::min<int64_t>(dataBytes, UINT32_MAX-36);
+    int bytesPerSample = sampleDepth/8;
+    std::vector<unsigned char> header;
+    for (char c : std::string("RIFF")) header.push_back(c);
+    AppendLE(header, 36+dataSize, 4);
+    for (char c : std::string("WAVEfmt ")) header.push_back(c);
+    AppendLE(header, 16, 4); // fmt chunk size
+    AppendLE(header, 1, 2); // PCM
+    AppendLE(header, 1, 2); // channels
+    AppendLE(header, sampleRate, 4);
+    AppendLE(header, sampleRate*bytesPerSample, 4); // byte rate
+    AppendLE(header, bytesPerSample, 2); // block align
+    AppendLE(header, sampleDepth, 2);
+    for (char c : std::string("data")) header.push_back(c);
+    AppendLE(header, dataSize, 4);
+    return header;
+}
+
+// Above this much pending output the writer thread gets woken up even without a flush
+static const size_t asyncWriteBlockSize = 1 << 20;
+// When the disk can't keep up, writers block above this much pending output instead of growing it indefinitely
+static const size_t asyncMaxPendingSize = 16*asyncWriteBlockSize;
+
+AsyncOutputFile::AsyncOutputFile(std::string fileName, int flushIntervalMs) {
+    mFileName = fileName;
+    mFlushIntervalMs = flushIntervalMs;
+    mFlushRequested = false;
+    mClosing = false;
+    mWriteFailed = false;
+    mFp = fopen(fileName.c_str(), "wb");
+    if (mFp == NULL) GODEC_ERR << "Couldn't open file '" << fileName << "' for writing";
+    // We write in large blocks ourselves
+    setvbuf(mFp, NULL, _IONBF, 0);
+    mWriterThread = boost::thread(&AsyncOutputFile::WriterLoop, this);
+}
+
+AsyncOutputFile::~AsyncOutputFile() {
+    try {
+        close();
+    } catch (...) {
+    }
+}
+
+void AsyncOutputFile::write(const std::string& s) {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mSpaceCv.wait(lock, [this] { return mWriteFailed || mPending.size() < asyncMaxPendingSize; });
+    if (mWriteFailed) GODEC_ERR << "Failed writing to '" << mFileName << "'";
+    mPending += s;
+    if (mPending.size() >= asyncWriteBlockSize) mCv.notify_one();
+}
+
+void AsyncOutputFile::flush() {
+    boost::unique_lock<boost::mutex> lock(mMutex);
+    mFlushRequested = true;
+    mCv.notify_one();
+}
+
+void AsyncOutputFile::close() {
+    {
+        boost::unique_lock<boost::mutex> lock(mMutex);
+        if (mFp == NULL) return;
+        mClosing = true;
+        mCv.notify_one();
+    }
+    mWriterThread.join();
+    fclose(mFp);
+    mFp = NULL;
+    if (mWriteFailed) GODEC_ERR << "Failed writing to '" << mFileName << "'";
+}
+
+void AsyncOutputFile::WriterLoop() {
+    auto lastFlush = boost::chrono::steady_clock::now();
+    bool unflushed = false;
+    while (true) {
+        bool doFlush = false;
+        bool closing = false;
+        {
+            boost::unique_lock<boost::mutex> lock(mMutex);
+            auto ready = [this] { return mClosing || mFlushRequested || mPending.size() >= asyncWriteBlockSize; };
+            if (mFlushIntervalMs > 0) {
+                mCv.wait_until(lock, lastFlush+boost::chrono::milliseconds(mFlushIntervalMs), ready);
+            } else {
+                mCv.wait(lock, ready);
+            }
+            auto now = boost::chrono::steady_clock::now();
+            doFlush = mFlushRequested || mClosing || (mFlushIntervalMs > 0 && now-lastFlush >= boost::chrono::milliseconds(mFlushIntervalMs));
+            mFlushRequested = false;
+            closing = mClosing;
+            mWriting.swap(mPending);
+        }
+        mSpaceCv.notify_all();
+        if (!mWriting.empty()) {
+            if (fwrite(mWriting.data(), 1, mWriting.size(), mFp) != mWriting.size()) {
+                boost::unique_lock<boost::mutex> lock(mMutex);
+                mWriteFailed = true;
+                mSpaceCv.notify_all();
+            }
+            mWriting.clear();
+            unflushed = true;
+        }
+        if (doFlush) {
+            if (unflushed) fflush(mFp);
+            unflushed = false;
+            lastFlush = boost::chrono::steady_clock::now();
+        }
+        if (closing) break;
+    }
+}
+
+// Same output as std::fixed << std::setprecision(2), without the stream overhead
+static void AppendFixed2(std::string& out, double val) {
+    char buf[400];
+    int len = snprintf(buf, sizeof(buf), "%.2f", val);
+    out.append(buf, len);
+}
+
+// Looks up a field the json output formats can't do without, with a Godec error (instead of a nlohmann exception) when it is missing
+static const json& RequiredJsonField(const json& j, const char* key, const std::string& lpId) {
+    if (!j.is_object() || j.count(key) == 0) GODEC_ERR << lpId << ": Json message is missing field '" << key << "':" << std::endl << j.dump(4);
+    return j[key];
+}
+static const json kNoJsonEntries = json::array();
+
+static std::string ShardPartFileName(std::string fileName, int shardIndex) {
+    return fileName + ".shard" + std::to_string(shardIndex);
+}
+
+std::string FileWriterHolder::ShardedFileName(std::string fileName) {
+    if (mNumShards == 1) return fileName;
+    mShardedOutputFile = fileName;
+    return ShardPartFileName(fileName, mShardIndex);
+}
+
+// The shards' FileWriters each report their part being done, whichever is the last one puts them together. The shards are consecutive blocks of the input, so going in shard order gives the order of the unsharded run
+static std::mutex shardedOutputsMutex;
+static unordered_map<std::string, int> shardedOutputsNumDone;
+
+static void MergeShardParts(std::string fileName, int numShards, bool isNpz) {
+    {
+        std::lock_guard<std::mutex> lock(shardedOutputsMutex);
+        std::string key = boost::filesystem::absolute(fileName).string();
+        if (++shardedOutputsNumDone[key] < numShards) return;
+        shardedOutputsNumDone.erase(key);
+    }
+    if (isNpz) {
+        try {
+            cnpy::npz_writer out(fileName);
+            for (int shardIdx = 0; shardIdx < numShards; shardIdx++) {
+                cnpy::npz_file part(ShardPartFileName(fileName, shardIdx));
+                auto keys = part.keys();
+                for (auto keyIt = keys.begin(); keyIt != keys.end(); keyIt++) {
+                    cnpy::npy_info info;
+                    const float* data = (const float*)part.data_ptr(*keyIt, info);
+                    if (data == NULL || info.type != 'f' || info.word_size != sizeof(float) || info.shape.size() != 2 || !info.fortran_order) GODEC_ERR << "Unexpected array '" << *keyIt << "' in " << part.name();
+                    out.begin_array<float>(*keyIt, info.shape[0]);
+                    out.append_columns(data, info.shape[0], info.shape[1]);
+                    out.end_array();
+                }
+            }
+            out.close();
+        } catch (const std::runtime_error& e) {
+            GODEC_ERR << "Failed merging the shards of npz file '" << fileName << "': " << e.what();
+        }
+    } else {
+        FILE* out = fopen(fileName.c_str(), "wb");
+        if (out == NULL) GODEC_ERR << "Couldn't open file '" << fileName << "' for writing";
+        std::vector<char> buffer(asyncWriteBlockSize);
+        for (int shardIdx = 0; shardIdx < numShards; shardIdx++) {
+            std::string partName = ShardPartFileName(fileName, shardIdx);
+            FILE* part = fopen(partName.c_str(), "rb");
+            if (part == NULL) GODEC_ERR << "Couldn't open shard file '" << partName << "'";
+            size_t numRead;
+            while ((numRead = fread(buffer.data(), 1, buffer.size(), part)) > 0) {
+                if (fwrite(buffer.data(), 1, numRead, out) != numRead) GODEC_ERR << "Failed writing to '" << fileName << "'";
+            }
+            fclose(part);
+        }
+        if (fclose(out) != 0) GODEC_ERR << "Failed writing to '" << fileName << "'";
+    }
+    for (int shardIdx = 0; shardIdx < numShards; shardIdx++) boost::filesystem::remove(ShardPartFileName(fileName, shardIdx));
+}
+
+void FileWriterHolder::Close() {
+    CloseAudioFile();
+    if (raw_text_writer != nullptr) raw_text_writer->close();
+    if (json_output_writer != nullptr) json_output_writer->close();
+    if (mNpzWriter != nullptr) mNpzWriter->close();
+    if (!mShardedOutputFile.empty()) {
+        std::string outputFile = mShardedOutputFile;
+        mShardedOutputFile = "";
+        MergeShardParts(outputFile, mNumShards, mInputType == Features);
+    }
+}
+
+void FileWriterHolder::OpenAudioFile(std::string fileName, float sampleRate) {
+    audioFp = fopen(fileName.c_str(), "wb");
+    if (audioFp == NULL) GODEC_ERR << "Couldn't open audio file '" << fileName << "' for writing";
+    mAudioBytesWritten = 0;
+    mLastAudioFlush = std::chrono::steady_clock::now();
+    if (mAudioWavHeader) {
+        // Sizes are placeholders until the file gets closed
+        std::vector<unsigned char> header = CreateWavHeader((uint32_t)(sampleRate+0.5f), mAudioSampleDepth, 0);
+        fwrite(header.data(), 1, header.size(), audioFp);
+    }
+}
+
+void FileWriterHolder::WriteAudio(const unsigned char* data, size_t numBytes) {
+    if (numBytes > 0 && fwrite(data, 1, numBytes, audioFp) != numBytes) GODEC_ERR << "Failed writing audio data";
+    mAudioBytesWritten += numBytes;
+    if (mFlushIntervalMs > 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now-mLastAudioFlush >= std::chrono::milliseconds(mFlushIntervalMs)) {
+            fflush(audioFp);
+            mLastAudioFlush = now;
+        }
+    }
+}
+
+void FileWriterHolder::CloseAudioFile() {
+    if (audioFp == NULL) return;
+    if (mAudioWavHeader) {
+        // Patch the RIFF and data chunk sizes, leaving the rest of the header as is
+        std::vector<unsigned char> sizeBytes;
+        AppendLE(sizeBytes, (uint32_t)std::min<int64_t>(36+mAudioBytesWritten, UINT32_MAX), 4);
+        fseek(audioFp, 4, SEEK_SET);
+        fwrite(sizeBytes.data(), 1, 4, audioFp);
+        sizeBytes.clear();
+        AppendLE(sizeBytes, (uint32_t)std::min<int64_t>(mAudioBytesWritten, UINT32_MAX-36), 4);
+        fseek(audioFp, 40, SEEK_SET);
+        fwrite(sizeBytes.data(), 1, 4, audioFp);
+    }
+    fclose(audioFp);
+    audioFp = NULL;
+}
+
 FileWriterInputType String2FWType(std::string ts) {
     if (ts == "audio") return Audio;
     else if (ts == "raw_text") return RawText;
@@ -40,17 +298,25 @@ FileWriterInputType String2FWType(std::string ts) {
 
 boost::shared_ptr<FileWriterHolder> FileWriterComponent::GetFileWriterFromConfig( ComponentGraphConfig* configPt) {
     auto fwh = boost::shared_ptr<FileWriterHolder>(new FileWriterHolder());
+    // Output always gets flushed at the end of an utterance (audio) or conversation (text, json), this is for watching the files grow
+    if (configPt->get_optional_READ_DECLARATION_BEFORE_USE<int>("flush_interval_ms")) {
+        fwh->mFlushIntervalMs = configPt->get<int>("flush_interval_ms", "Interval in milliseconds in which output additionally gets flushed to disk (optional, default 0 = only at utterance/conversation ends)");
+    }
 
     fwh->mInputType = String2FWType(configPt->get<std::string>("input_type", "Input stream type (audio, raw_text, features, json)"));
+    fwh->mNumShards = configPt->globalVals.get<int>(LoopProcessor::NumShards);
+    fwh->mShardIndex = configPt->globalVals.get<int>(LoopProcessor::ShardIndex);
     if (fwh->mInputType == Audio) {
         fwh->mAudioPrefix = configPt->get<std::string>("output_file_prefix", "Output audio file path prefix");
         int depth = configPt->get<int>("sample_depth", "wave file sample depth (8,16,32)");
         if (depth != 8 && depth != 16 && depth != 32) GODEC_ERR << getLPId() << "Unsuported audio sample depth " << depth;
         fwh->mAudioSampleDepth = depth;
-        fwh->audioFp = NULL;
+        std::string audioFileFormat = configPt->get<std::string>("audio_file_format", "Audio file format (raw, wav)");
+        if (audioFileFormat != "raw" && audioFileFormat != "wav") GODEC_ERR << getLPId() << "Unknown audio_file_format '" << audioFileFormat << "'. Valid options are: raw, wav";
+        fwh->mAudioWavHeader = audioFileFormat == "wav";
     } else if (fwh->mInputType == RawText) {
         std::string output_file = configPt->get<std::string>("output_file", "Output text file path");
-        fwh->raw_text_writer.open(output_file);
+        fwh->raw_text_writer = boost::shared_ptr<AsyncOutputFile>(new AsyncOutputFile(fwh->ShardedFileName(output_file), fwh->mFlushIntervalMs));
     } else if (fwh->mInputType == Json) {
         std::string output_file = configPt->get<std::string>("output_file", "Json output file path");
         fwh->mJsonOutputFormat = configPt->get<std::string>("json_output_format", "Output format for json (raw_json, ctm, fst_search, mt)");
@@ -58,10 +324,14 @@ boost::shared_ptr<FileWriterHolder> FileWriterComponent::GetFileWriterFromConfig
         if (fwh->mJsonOutputFormat != "raw_json" && fwh->mJsonOutputFormat != "ctm" && fwh->mJsonOutputFormat != "fst_search" && fwh->mJsonOutputFormat != "mt") {
             GODEC_ERR << ": Invalid json_output_format '" << fwh->mJsonOutputFormat << "'. Use 'raw_json' if you just want to dump json string." << std::endl;
         }
-        fwh->json_output_writer.open(output_file);
+        fwh->json_output_writer = boost::shared_ptr<AsyncOutputFile>(new AsyncOutputFile(fwh->ShardedFileName(output_file), fwh->mFlushIntervalMs));
     } else if (fwh->mInputType == Features) {
         fwh->mFeaturesNpz = configPt->get<std::string>("npz_file", "Output Numpy npz file name");
-        boost::filesystem::remove(fwh->mFeaturesNpz);
+        try {
+            fwh->mNpzWriter = boost::shared_ptr<cnpy::npz_writer>(new cnpy::npz_writer(fwh->ShardedFileName(fwh->mFeaturesNpz)));
+        } catch (const std::runtime_error& e) {
+            GODEC_ERR << "Couldn't open npz file '" << fwh->mFeaturesNpz << "' for writing: " << e.what();
+        }
     }
     return fwh;
 }
@@ -78,6 +348,7 @@ FileWriterComponent::FileWriterComponent(std::string id, ComponentGraphConfig *c
     if (mControlType == "single_on_startup") {
         mCurrentFWH = GetFileWriterFromConfig(configPt);
     } else if (mControlType == "external") {
+        if (configPt->globalVals.get<int>(LoopProcessor::NumShards) > 1) GODEC_ERR << getLPId() << ": A FileWriter inside a sharded Submodule can't be externally controlled";
         addInputSlotAndUUID(SlotControl, UUID_JsonDecoderMessage);
     } else GODEC_ERR << "Unknown control type " << mControlType;
 
@@ -89,6 +360,8 @@ FileWriterComponent::FileWriterComponent(std::string id, ComponentGraphConfig *c
 }
 
 void FileWriterComponent::Shutdown() {
+    // Buffered output (and the npz's central directory) only gets written when closing, this has to happen before the graph considers us done
+    if (mCurrentFWH != nullptr) mCurrentFWH->Close();
     LoopProcessor::Shutdown();
 }
 
@@ -109,8 +382,10 @@ void FileWriterComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
     }
 
     if (mCurrentFWH->mInputType == Audio) {
+        auto audioMsg = baseInputMsg->getUUID() == UUID_AudioDecoderMessage ? msgBlock.get<AudioDecoderMessage>(SlotInput) : nullptr;
+        if (audioMsg == nullptr && baseInputMsg->getUUID() != UUID_BinaryDecoderMessage) GODEC_ERR << "Unexpected message type ";
         if (mCurrentFWH->audioFp == NULL) {
-            std::string completeFilename = mCurrentFWH->mAudioPrefix + convStateMsg->mUtteranceId + ".raw";
+            std::string completeFilename = mCurrentFWH->mAudioPrefix + convStateMsg->mUtteranceId + (mCurrentFWH->mAudioWavHeader ? ".wav" : ".raw");
             for (int idx = 0; idx < completeFilename.length(); idx++) {
                 char c = completeFilename[idx];
                 if (!(
@@ -126,61 +401,61 @@ void FileWriterComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
                     completeFilename[idx] = '_';
                 }
             }
-            mCurrentFWH->audioFp = fopen(completeFilename.c_str(), "wb");
-            if (mCurrentFWH->audioFp == NULL) GODEC_ERR << "Couldn't open audio file '" << completeFilename << "' for writing";
-        }
-        if (baseInputMsg->getUUID() == UUID_AudioDecoderMessage) {
-            auto audioMsg = msgBlock.get<AudioDecoderMessage>(SlotInput);
-            const Vector audioData = audioMsg->mAudio.cwiseMin(1.0).cwiseMax(-1.0);
-            for (int i = 0; i < audioData.size(); i++) {
-                if (mCurrentFWH->mAudioSampleDepth == 8) {
-                    int8_t val = (char)(INT8_MAX*audioData(i));
-                    fwrite(&val, sizeof(int8_t), 1, mCurrentFWH->audioFp);
-                } else if (mCurrentFWH->mAudioSampleDepth == 16) {
-                    int16_t val = (int16_t)(INT16_MAX*audioData(i));
-                    fwrite(&val, sizeof(int16_t), 1, mCurrentFWH->audioFp);
-                } else if (mCurrentFWH->mAudioSampleDepth == 32) {
-                    int32_t val = (int32_t)(INT32_MAX*audioData(i));
-                    fwrite(&val, sizeof(int32_t), 1, mCurrentFWH->audioFp);
+            if (mCurrentFWH->mAudioWavHeader && audioMsg == nullptr) GODEC_ERR << getLPId() << ": WAV output needs AudioDecoderMessage input, the sample rate of binary input is unknown";
+            mCurrentFWH->OpenAudioFile(completeFilename, audioMsg != nullptr ? audioMsg->mSampleRate : 0.0f);
+        }
+        if (audioMsg != nullptr) {
+            auto& buffer = mCurrentFWH->mAudioBuffer;
+            if (mCurrentFWH->mAudioSampleDepth == 8) {
+                ConvertAudioSamples<int8_t>(audioMsg->mAudio, buffer);
+                // 8-bit WAV samples are unsigned
+                if (mCurrentFWH->mAudioWavHeader) {
+                    for (size_t i = 0; i < buffer.size(); i++) buffer[i] ^= 0x80;
                 }
+            } else if (mCurrentFWH->mAudioSampleDepth == 16) {
+                ConvertAudioSamples<int16_t>(audioMsg->mAudio, buffer);
+            } else if (mCurrentFWH->mAudioSampleDepth == 32) {
+                ConvertAudioSamples<int32_t>(audioMsg->mAudio, buffer);
             }
-        } else if (baseInputMsg->getUUID() == UUID_BinaryDecoderMessage) {
+            mCurrentFWH->WriteAudio(buffer.data(), buffer.size());
+        } else {
             auto binaryMsg =msgBlock.get<BinaryDecoderMessage>(SlotInput);
             const std::vector<unsigned char> &data = binaryMsg->mData;
-            fwrite(&data[0], sizeof(unsigned char), data.size(), mCurrentFWH->audioFp);
-        } else
-            GODEC_ERR << "Unexpected message type ";
-        fflush(mCurrentFWH->audioFp);
+            mCurrentFWH->WriteAudio(data.data(), data.size());
+        }
         if (convStateMsg->mLastChunkInUtt) {
-            fclose(mCurrentFWH->audioFp);
-            mCurrentFWH->audioFp = NULL;
+            mCurrentFWH->CloseAudioFile();
         }
     } else if (mCurrentFWH->mInputType == RawText) {
         auto binaryMsg = msgBlock.get<BinaryDecoderMessage>(SlotInput);
-        mCurrentFWH->raw_text_writer << CharVec2String(binaryMsg->mData) << std::endl;
-        mCurrentFWH->raw_text_writer.flush();
+        std::string line(binaryMsg->mData.begin(), binaryMsg->mData.end());
+        line += '\n';
+        mCurrentFWH->raw_text_writer->write(line);
+        if (convStateMsg->mLastChunkInConvo) mCurrentFWH->raw_text_writer->flush();
     } else if (mCurrentFWH->mInputType == Json) {
         auto jsonMsg = msgBlock.get<JsonDecoderMessage>(SlotInput);
-        WriteJsonOutput(jsonMsg, convStateMsg, msgBlock, mCurrentFWH->mJsonOutputFormat, mCurrentFWH->json_output_writer);
+        try {
+            WriteJsonOutput(jsonMsg, convStateMsg, msgBlock, mCurrentFWH->mJsonOutputFormat, *mCurrentFWH->json_output_writer);
+        } catch (const json::exception& e) {
+            GODEC_ERR << getLPId() << ": Malformed json message for output format '" << mCurrentFWH->mJsonOutputFormat << "': " << e.what();
+        }
+        if (convStateMsg->mLastChunkInConvo) mCurrentFWH->json_output_writer->flush();
     } else if (mCurrentFWH->mInputType == Features) {
         auto featsMsg = msgBlock.get<FeaturesDecoderMessage>(SlotInput);
-        if (mCurrentFWH->mFeaturesAccum.cols() == 0) {
-            mCurrentFWH->mFeaturesAccum = featsMsg->mFeatures;
-        } else {
-            mCurrentFWH->mFeaturesAccum.conservativeResize(mCurrentFWH->mFeaturesAccum.rows(), mCurrentFWH->mFeaturesAccum.cols()+featsMsg->mFeatures.cols());
-            mCurrentFWH->mFeaturesAccum.rightCols(featsMsg->mFeatures.cols()) = featsMsg->mFeatures;
-        }
-        if (convStateMsg->mLastChunkInUtt) {
-            std::vector<size_t> shape{(size_t)mCurrentFWH->mFeaturesAccum.rows(), (size_t)mCurrentFWH->mFeaturesAccum.cols()};
-            Matrix featsT = mCurrentFWH->mFeaturesAccum.transpose();
-            cnpy::npz_save(mCurrentFWH->mFeaturesNpz, featsMsg->mUtteranceId, featsT.data(), shape, "a");
-            mCurrentFWH->mFeaturesAccum = Matrix(0,0);
+        auto& npzWriter = mCurrentFWH->mNpzWriter;
+        try {
+            if (!npzWriter->in_array()) npzWriter->begin_array<float>(featsMsg->mUtteranceId, featsMsg->mFeatures.rows());
+            // The npz arrays are Fortran-ordered, so the (column-major) frames go straight to the file as they come in
+            npzWriter->append_columns(featsMsg->mFeatures.data(), featsMsg->mFeatures.rows(), featsMsg->mFeatures.cols());
+            if (convStateMsg->mLastChunkInUtt) npzWriter->end_array();
+        } catch (const std::runtime_error& e) {
+            GODEC_ERR << getLPId() << ": Failed writing to npz file '" << mCurrentFWH->mFeaturesNpz << "': " << e.what();
         }
     }
 }
-void FileWriterComponent::WriteJsonOutput(boost::shared_ptr<const JsonDecoderMessage> jsonMsg, boost::shared_ptr<const ConversationStateDecoderMessage> convMsg, const DecoderMessageBlock& msgBlock, std::string jsonOutputFormat, std::ofstream& json_output_writer) {
+void FileWriterComponent::WriteJsonOutput(boost::shared_ptr<const JsonDecoderMessage> jsonMsg, boost::shared_ptr<const ConversationStateDecoderMessage> convMsg, const DecoderMessageBlock& msgBlock, std::string jsonOutputFormat, AsyncOutputFile& json_output_writer) {
     if (jsonOutputFormat == "raw_json") {
-        json_output_writer << jsonMsg->getJsonObj().dump(4) << std::endl;
+        json_output_writer.write(jsonMsg->getJsonObj().dump(4)+"\n");
     } else if (jsonOutputFormat == "ctm" || jsonOutputFormat == "fst_search") {
         auto audioMsg =msgBlock.get<AudioDecoderMessage>(SlotStreamedAudio);
         float secondsPerTick = 1.0 / (audioMsg->mSampleRate*audioMsg->mTicksPerSample);
@@ -189,46 +464,50 @@ void FileWriterComponent::WriteJsonOutput(boost::shared_ptr<const JsonDecoderMes
         utterance_offset_in_file = audioMsg->getDescriptor("utterance_offset_in_file") != "" ? boost::lexical_cast<float>(audioMsg->getDescriptor("utterance_offset_in_file")) : 0;
         std::string file = audioMsg->getDescriptor("wave_file_name") != "" ? audioMsg->getDescriptor("wave_file_name") : "dummy";
         std::string channel = audioMsg->getDescriptor("channel") == "1" ? "A" : "B";
-        json_output_writer << std::fixed << std::setprecision(2);
-        json j = jsonMsg->getJsonObj();
+        std::string out;
+        const json& j = jsonMsg->getJsonObj();
         if (jsonOutputFormat == "ctm") {
-            for (size_t i = 0; i < j["words"].size(); ++i) {
-                json w = j["words"][i];
-                float wordBeginInSeconds = utterance_offset_in_file + mPrevConvoEndTimeInSecondsStreamBased + (w["beginTime"].get<int64_t>() - mPrevConvoEndTimeInTicksStreamBased + 1) * secondsPerTick;
-                float wordDurationInSeconds = w["duration"].get<int64_t>() * secondsPerTick;
-
-                json_output_writer << file << " "
-                                   << channel << " "
-                                   << wordBeginInSeconds << " "
-                                   << wordDurationInSeconds << " "
-                                   << w["word"].get<std::string>() << " "
-                                   << TwoDigitsPrecisionRound(w["score"]);
-
-                if(!w["case"].is_null()) {
-                    std::string wcase = w["case"].get<std::string>();
-                    json_output_writer << " case:" << wcase;
+            // Like before, a message without words just doesn't produce any lines
+            const json& words = j.is_object() && j.count("words") != 0 ? j["words"] : kNoJsonEntries;
+            for (size_t i = 0; i < words.size(); ++i) {
+                const json& w = words[i];
+                float wordBeginInSeconds = utterance_offset_in_file + mPrevConvoEndTimeInSecondsStreamBased + (RequiredJsonField(w, "beginTime", getLPId()).get<int64_t>() - mPrevConvoEndTimeInTicksStreamBased + 1) * secondsPerTick;
+                float wordDurationInSeconds = RequiredJsonField(w, "duration", getLPId()).get<int64_t>() * secondsPerTick;
+
+                out += file + " " + channel + " ";
+                AppendFixed2(out, wordBeginInSeconds);
+                out += ' ';
+                AppendFixed2(out, wordDurationInSeconds);
+                out += " " + RequiredJsonField(w, "word", getLPId()).get_ref<const std::string&>() + " ";
+                AppendFixed2(out, TwoDigitsPrecisionRound(RequiredJsonField(w, "score", getLPId())));
+
+                auto caseIt = w.find("case");
+                if(caseIt != w.end() && !caseIt->is_null()) {
+                    out += " case:" + caseIt->get_ref<const std::string&>();
                 }
-                if(!w["punc"].is_null()) {
-                    std::string wpunc = w["punc"].get<std::string>();
-                    json_output_writer << " punc:" << wpunc;
+                auto puncIt = w.find("punc");
+                if(puncIt != w.end() && !puncIt->is_null()) {
+                    out += " punc:" + puncIt->get_ref<const std::string&>();
                 }
-                json_output_writer << std::endl;
+                out += '\n';
             }
         } else if (jsonOutputFormat == "fst_search") {
-            float beginTime = utterance_offset_in_file + mPrevConvoEndTimeInSecondsStreamBased + (j["beginTime"].get<int64_t>() - mPrevConvoEndTimeInTicksStreamBased + 1) * secondsPerTick;
-            for (size_t i = 0; i < j["searchOutput"].size(); ++i) {
-                json& w = j["searchOutput"][i];
-                float wordBeginInSeconds = beginTime + w["relativeBeginTime"].get<int64_t>() * secondsPerTick;
-                float wordDurationInSeconds = w["duration"].get<int64_t>() * secondsPerTick;
-                json_output_writer << file << " "
-                                   << channel << " "
-                                   << wordBeginInSeconds << " "
-                                   << wordDurationInSeconds << " "
-                                   << w["outputString"].get<std::string>() << " "
-                                   << TwoDigitsPrecisionRound(w["score"]);
-                json_output_writer << std::endl;
+            float beginTime = utterance_offset_in_file + mPrevConvoEndTimeInSecondsStreamBased + (RequiredJsonField(j, "beginTime", getLPId()).get<int64_t>() - mPrevConvoEndTimeInTicksStreamBased + 1) * secondsPerTick;
+            const json& searchOutput = j.is_object() && j.count("searchOutput") != 0 ? j["searchOutput"] : kNoJsonEntries;
+            for (size_t i = 0; i < searchOutput.size(); ++i) {
+                const json& w = searchOutput[i];
+                float wordBeginInSeconds = beginTime + RequiredJsonField(w, "relativeBeginTime", getLPId()).get<int64_t>() * secondsPerTick;
+                float wordDurationInSeconds = RequiredJsonField(w, "duration", getLPId()).get<int64_t>() * secondsPerTick;
+                out += file + " " + channel + " ";
+                AppendFixed2(out, wordBeginInSeconds);
+                out += ' ';
+                AppendFixed2(out, wordDurationInSeconds);
+                out += " " + RequiredJsonField(w, "outputString", getLPId()).get_ref<const std::string&>() + " ";
+                AppendFixed2(out, TwoDigitsPrecisionRound(RequiredJsonField(w, "score", getLPId())));
+                out += '\n';
             }
         }
+        json_output_writer.write(out);
 
         // Ralf: This is an incredibly ugly allowance for the fact that CTMs are in reference to the analist's audio file. Pt II
         auto origConvMsg = msgBlock.get<ConversationStateDecoderMessage>(SlotFileFeederConvstate);
@@ -240,12 +519,9 @@ void FileWriterComponent::WriteJsonOutput(boost::shared_ptr<const JsonDecoderMes
         }
         mPrevConvoEndTimeInTicksStreamBased = origConvMsg->getTime();
     } else if (jsonOutputFormat == "mt") {
-        json j = jsonMsg->getJsonObj();
-        const std::string& translatedText = j["translatedText"].get<std::string>();
-        json_output_writer << translatedText << std::endl;
+        const std::string& translatedText = RequiredJsonField(jsonMsg->getJsonObj(), "translatedText", getLPId()).get_ref<const std::string&>();
+        json_output_writer.write(translatedText+"\n");
     }
-
-    json_output_writer.flush();
 }
 
 }
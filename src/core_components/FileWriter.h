@@ -2,8 +2,11 @@
 
 #include "godec/ChannelMessenger.h"
 #include "GodecMessages.h"
+#include "cnpy.h"
 #include <stdio.h>
 #include <fstream>
+#include <boost/thread.hpp>
+#include <chrono>
 
 namespace Godec {
 
@@ -14,34 +17,70 @@ enum FileWriterInputType {
     Json
 };
 
+// Collects formatted output in memory and has a background thread write it out in large blocks. Only flushes to disk when asked to, or every "flush interval"
+class AsyncOutputFile {
+  public:
+    AsyncOutputFile(std::string fileName, int flushIntervalMs);
+    ~AsyncOutputFile();
+    void write(const std::string& s);
+    void flush();
+    void close();
+  private:
+    void WriterLoop();
+    FILE* mFp;
+    std::string mFileName;
+    int mFlushIntervalMs;
+    std::string mPending;
+    std::string mWriting;
+    bool mFlushRequested;
+    bool mClosing;
+    bool mWriteFailed;
+    boost::mutex mMutex;
+    boost::condition_variable mCv;
+    boost::condition_variable mSpaceCv;
+    boost::thread mWriterThread;
+};
+
 class FileWriterHolder {
   public:
     FileWriterHolder() {
         audioFp = nullptr;
+        mAudioWavHeader = false;
+        mFlushIntervalMs = 0;
+        mAudioBytesWritten = 0;
+        mNumShards = 1;
+        mShardIndex = 0;
     }
     ~FileWriterHolder() {
-        if (audioFp != NULL) {
-            fclose(audioFp);
-        }
-        if (raw_text_writer.is_open()) {
-            raw_text_writer.close();
-        }
-        if (json_output_writer.is_open()) {
-            json_output_writer.close();
-        }
+        CloseAudioFile();
     }
 
+    void Close();
+    // Inside a sharded Submodule, each shard writes its own part of the output file
+    std::string ShardedFileName(std::string fileName);
+    void OpenAudioFile(std::string fileName, float sampleRate);
+    void WriteAudio(const unsigned char* data, size_t numBytes);
+    void CloseAudioFile();
+
     FILE* audioFp;
     std::string mAudioPrefix;
     int mAudioSampleDepth;
+    bool mAudioWavHeader;
+    int mFlushIntervalMs;
+    std::chrono::steady_clock::time_point mLastAudioFlush;
+    int64_t mAudioBytesWritten;
+    std::vector<unsigned char> mAudioBuffer;
 
-    std::ofstream raw_text_writer;
-    std::ofstream json_output_writer;
+    boost::shared_ptr<AsyncOutputFile> raw_text_writer;
+    boost::shared_ptr<AsyncOutputFile> json_output_writer;
     FileWriterInputType mInputType;
     std::string mFstPrefix;
     std::string mJsonOutputFormat;
     std::string mFeaturesNpz;
-    Matrix mFeaturesAccum;
+    boost::shared_ptr<cnpy::npz_writer> mNpzWriter;
+    int mNumShards;
+    int mShardIndex;
+    std::string mShardedOutputFile;
 };
 
 
@@ -53,7 +92,7 @@ class FileWriterComponent : public LoopProcessor {
     void Shutdown();
   private:
     void ProcessMessage(const DecoderMessageBlock& msgBlock);
-    void WriteJsonOutput(boost::shared_ptr<const JsonDecoderMessage> jsonMsg, boost::shared_ptr<const ConversationStateDecoderMessage> convMsg, const DecoderMessageBlock& msgBlock, std::string jsonOutputFormat, std::ofstream& json_output_writer);
+    void WriteJsonOutput(boost::shared_ptr<const JsonDecoderMessage> jsonMsg, boost::shared_ptr<const ConversationStateDecoderMessage> convMsg, const DecoderMessageBlock& msgBlock, std::string jsonOutputFormat, AsyncOutputFile& json_output_writer);
     boost::shared_ptr<FileWriterHolder> GetFileWriterFromConfig( ComponentGraphConfig* configPt);
     static std::string SlotInput;
     static std::string SlotFileFeederConvstate;
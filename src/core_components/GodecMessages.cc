@@ -1124,7 +1124,7 @@ DecoderMessage_ptr BinaryDecoderMessage::fromPython(PyObject* pMsg) {
 std::string JsonDecoderMessage::describeThyself() const {
     std::stringstream ss;
     ss << DecoderMessage::describeThyself();
-    ss << mJson.dump(4);
+    ss << mJson->dump(4);
     return ss.str();
 }
 
@@ -1137,7 +1137,7 @@ jobject JsonDecoderMessage::toJNI(JNIEnv *env) {
     jmethodID msgInit = env->GetMethodID(JsonDecoderMessageClass, "<init>", "(JLjava/lang/String;)V");
     jlong time = getTime();
     env->PushLocalFrame(3); // jTag, JJsonStr, retObj
-    jstring jJsonString = env->NewStringUTF(mJson.dump().c_str());
+    jstring jJsonString = env->NewStringUTF(mJson->dump().c_str());
     jobject retObj = env->NewObject(JsonDecoderMessageClass, msgInit, time, jJsonString);
     return env->PopLocalFrame(retObj);
 }
@@ -1153,15 +1153,14 @@ DecoderMessage_ptr JsonDecoderMessage::fromJNI(JNIEnv* env, jobject jMsg) {
     uint64_t time;
     std::string descriptorString;
     JNIGetDecoderMessageVals(env, jMsg, time, descriptorString);
-    json j = json::parse(jsonString);
-    return JsonDecoderMessage::create(time, j);
+    return JsonDecoderMessage::create(time, json::parse(jsonString));
 }
 
 #ifndef ANDROID
 PyObject* JsonDecoderMessage::toPython() {
     GodecMessages_init_numpy();
 
-    PyObject *pArgList = Py_BuildValue("ls", getTime(), PyUnicode_FromString(mJson.dump().c_str()));
+    PyObject *pArgList = Py_BuildValue("ls", getTime(), PyUnicode_FromString(mJson->dump().c_str()));
     if (pArgList == NULL) GODEC_ERR << "Could not create arglist";
     PyObject* pModuleObj = PyImport_ImportModule("godec");
     if (pModuleObj == NULL) GODEC_ERR << "Could not import godec module";
@@ -1185,9 +1184,7 @@ DecoderMessage_ptr JsonDecoderMessage::fromPython(PyObject* pMsg) {
 
     PyObject* pJson = PyDict_GetItemString(pMsg,"json");
     if (pJson == nullptr) GODEC_ERR << "JsonDecoderMessage::fromPython: Passed in dict does not contain 'json' field!";
-    json j = json::parse(PyUnicode_AsUTF8(pJson));
-
-    DecoderMessage_ptr outMsg = JsonDecoderMessage::create(time, j);
+    DecoderMessage_ptr outMsg = JsonDecoderMessage::create(time, json::parse(PyUnicode_AsUTF8(pJson)));
     (boost::const_pointer_cast<DecoderMessage>(outMsg))->setFullDescriptorString(descriptorString);
     Py_DECREF(pJson);
     return outMsg;
@@ -1226,7 +1223,15 @@ bool JsonDecoderMessage::canSliceAt(uint64_t sliceTime,
 DecoderMessage_ptr JsonDecoderMessage::create(uint64_t time, json &jsonObj) {
     JsonDecoderMessage* msg = new JsonDecoderMessage();
     msg->setTime(time);
-    msg->mJson = jsonObj;
+    msg->mJson = boost::make_shared<const json>(jsonObj);
+
+    return DecoderMessage_ptr(msg);
+}
+
+DecoderMessage_ptr JsonDecoderMessage::create(uint64_t time, json &&jsonObj) {
+    JsonDecoderMessage* msg = new JsonDecoderMessage();
+    msg->setTime(time);
+    msg->mJson = boost::make_shared<const json>(std::move(jsonObj));
 
     return DecoderMessage_ptr(msg);
 }
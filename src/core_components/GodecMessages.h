@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include "boost/function.hpp"
+#include <boost/make_shared.hpp>
 #include <godec/json.hpp>
 #include <boost/serialization/map.hpp>
 #include <boost/serialization/shared_ptr.hpp>
@@ -255,6 +256,7 @@ class BinaryDecoderMessage : public DecoderMessage {
  */
 class JsonDecoderMessage : public DecoderMessage {
   public:
+    JsonDecoderMessage() : mJson(boost::make_shared<const json>()) {};
     ~JsonDecoderMessage() {};
 
     std::string describeThyself() const override;
@@ -280,27 +282,30 @@ class JsonDecoderMessage : public DecoderMessage {
     void shiftInTime(int64_t deltaT);
     uuid getUUID() const override { return UUID_JsonDecoderMessage; };
     static uuid getUUIDStatic() { return UUID_JsonDecoderMessage; };
-    json getJsonObj() const { return mJson; }
-    void setJsonObj(const json& rhs) { mJson = rhs; }
+    const json& getJsonObj() const { return *mJson; }
+    void setJsonObj(const json& rhs) { mJson = boost::make_shared<const json>(rhs); }
     static DecoderMessage_ptr create(uint64_t time, json& jsonObj);
+    static DecoderMessage_ptr create(uint64_t time, json&& jsonObj);
 
   private:
-    json mJson;
+    // The JSON never gets modified after creation, so clones can share it
+    boost::shared_ptr<const json> mJson;
 
     friend class boost::serialization::access;
     template<class Archive>
     void save(Archive & ar, const unsigned int version) const {
         ar & boost::serialization::base_object<DecoderMessage>(*this);
-        std::string s = mJson.dump(2);
-        ar & s;
+        // CBOR is a lot more compact (and faster to parse back) than the JSON text
+        std::vector<uint8_t> cbor = json::to_cbor(*mJson);
+        ar & cbor;
     }
 
     template<class Archive>
     void load(Archive & ar, const unsigned int version) {
         ar & boost::serialization::base_object<DecoderMessage>(*this);
-        std::string s;
-        ar & s;
-        mJson = json::parse(s);
+        std::vector<uint8_t> cbor;
+        ar & cbor;
+        mJson = boost::make_shared<const json>(json::from_cbor(cbor));
     }
     BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
@@ -0,0 +1,101 @@
+#include "MelFilterbank.h"
+#include <godec/ComponentGraph.h>
+#include <boost/format.hpp>
+
+namespace Godec {
+
+static float Mel(float freq) {
+    return 1127.0f*log(1.0f + freq/700.0f);
+}
+
+MelBanks::MelBanks(int fftSize, float samplingFrequency, int numMelBins, float lowFreq, float highFreq) {
+    int numBins = fftSize/2+1;
+    float binWidth = samplingFrequency/fftSize;
+    float melLow = Mel(lowFreq);
+    float melDelta = (Mel(highFreq) - melLow)/(numMelBins + 1);
+
+    std::vector<Eigen::Triplet<float>> weights;
+    for (int melIdx = 0; melIdx < numMelBins; melIdx++) {
+        float leftMel = melLow + melIdx*melDelta;
+        float centerMel = leftMel + melDelta;
+        float rightMel = centerMel + melDelta;
+        for (int binIdx = 0; binIdx < numBins; binIdx++) {
+            float mel = Mel(binIdx*binWidth);
+            if (mel <= leftMel || mel >= rightMel) continue;
+            float weight = (mel <= centerMel) ? (mel - leftMel)/(centerMel - leftMel) : (rightMel - mel)/(rightMel - centerMel);
+            weights.push_back(Eigen::Triplet<float>(melIdx, binIdx, weight));
+        }
+    }
+    mWeights.resize(numMelBins, numBins);
+    mWeights.setFromTriplets(weights.begin(), weights.end());
+}
+
+void MelBanks::compute(const Matrix& powerSpectrum, Eigen::Ref<Matrix> out) const {
+    if (powerSpectrum.rows() != mWeights.cols()) GODEC_ERR << "Expected power spectra with " << mWeights.cols() << " bins, got " << powerSpectrum.rows();
+    out.noalias() = mWeights*powerSpectrum;
+}
+
+void MelBanksOptions::validate() {
+    float nyquist = 0.5f*samplingFrequency;
+    if (highFreq <= 0.0f) highFreq += nyquist;
+    if (numMelBins < 1) GODEC_ERR << "num_mel_bins needs to be at least 1";
+    if (!(lowFreq >= 0.0f && lowFreq < highFreq && highFreq <= nyquist)) GODEC_ERR << "Bad mel filter range: need 0 <= low_freq < high_freq <= " << nyquist << ", got " << lowFreq << " and " << highFreq;
+}
+
+MelFilterbankComponent::~MelFilterbankComponent() {
+}
+
+LoopProcessor* MelFilterbankComponent::make(std::string id, ComponentGraphConfig* configPt) {
+    return new MelFilterbankComponent(id, configPt);
+}
+std::string MelFilterbankComponent::describeThyself() {
+    return "Calculates mel filterbank features on incoming windowed audio (feature input message produced by Window component)";
+}
+
+/* MelFilterbankComponent::ExtendedDescription
+The filters are triangular and equally spaced on the mel scale (mel = 1127*ln(1+f/700)), applied to the power spectrum (see Spectrum component for the FFT size). With "log_mel" the output is the natural log of the filter outputs, floored at the float epsilon. "append_energy" works as in the Spectrum component
+*/
+
+MelFilterbankComponent::MelFilterbankComponent(std::string id, ComponentGraphConfig* configPt) :
+    LoopProcessor(id,configPt) {
+    mMelOptions.samplingFrequency = configPt->get<float>("sampling_frequency", "Source sampling rate");
+    mMelOptions.numMelBins = configPt->get<int>("num_mel_bins", "Number of triangular mel filters");
+    mMelOptions.lowFreq = configPt->get<float>("low_freq", "Lower edge of the lowest mel filter, in Hz");
+    mMelOptions.highFreq = configPt->get<float>("high_freq", "Upper edge of the highest mel filter, in Hz. Values <= 0 are relative to the Nyquist frequency");
+    mMelOptions.validate();
+    mLogMel = configPt->get<bool>("log_mel", "Output log mel filterbank energies (true, false)");
+    mAppendEnergy = configPt->get<bool>("append_energy", "Append the frame energy in dB as a last row");
+    addInputSlotAndUUID(SlotWindowedAudio, UUID_FeaturesDecoderMessage);
+    std::list<std::string> requiredOutputSlots;
+    requiredOutputSlots.push_back(SlotFeatures);
+    initOutputs(requiredOutputSlots);
+}
+
+void MelFilterbankComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
+    auto convStateMsg = msgBlock.get<ConversationStateDecoderMessage>(SlotConversationState);
+    auto audioMsg = msgBlock.get<FeaturesDecoderMessage>(SlotWindowedAudio);
+    CheckWindowedAudio(getLPId(), *audioMsg);
+
+    if (mPowerSpectrum == nullptr) {
+        mPowerSpectrum = boost::shared_ptr<PowerSpectrum>(new PowerSpectrum(audioMsg->mFeatures.rows()));
+        mMelBanks = boost::shared_ptr<MelBanks>(new MelBanks(mPowerSpectrum->getFftSize(), mMelOptions.samplingFrequency, mMelOptions.numMelBins, mMelOptions.lowFreq, mMelOptions.highFreq));
+    }
+    Matrix powerSpectrum(mPowerSpectrum->getNumBins(), audioMsg->mFeatures.cols());
+    mPowerSpectrum->compute(audioMsg->mFeatures, powerSpectrum);
+    int numMel = mMelBanks->getNumMelBins();
+    Matrix outMat(numMel + (mAppendEnergy ? 1 : 0), audioMsg->mFeatures.cols());
+    auto melEnergies = outMat.topRows(numMel);
+    mMelBanks->compute(powerSpectrum, melEnergies);
+    if (mLogMel) melEnergies = FloorLog(melEnergies);
+
+    boost::format fmter("MELFB[0:%1%]%%f");
+    fmter % (numMel - 1);
+    std::string featureNames = fmter.str();
+    if (mAppendEnergy) AppendEnergyRow(audioMsg->mFeatures, outMat, featureNames);
+
+    pushToOutputs(SlotFeatures, FeaturesDecoderMessage::create(
+                      convStateMsg->getTime(), convStateMsg->mUtteranceId,
+                      outMat, featureNames, audioMsg->mFeatureTimestamps));
+}
+
+}
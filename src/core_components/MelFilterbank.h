@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Spectrum.h"
+
+namespace Godec {
+
+// Triangular filters, equally spaced on the mel scale, applied to a batch of power spectra. Each filter only covers a few bins, so the weights are kept sparse
+class MelBanks {
+  public:
+    MelBanks(int fftSize, float samplingFrequency, int numMelBins, float lowFreq, float highFreq);
+    int getNumMelBins() const { return mWeights.rows(); }
+    void compute(const Matrix& powerSpectrum, Eigen::Ref<Matrix> out) const;
+  private:
+    Eigen::SparseMatrix<float, Eigen::RowMajor> mWeights;
+};
+
+// The mel filter parameters shared by MelFilterbank and Mfcc
+struct MelBanksOptions {
+    float samplingFrequency;
+    int numMelBins;
+    float lowFreq;
+    float highFreq;
+    // Resolves a Nyquist-relative high_freq and checks the ranges
+    void validate();
+};
+
+class MelFilterbankComponent : public LoopProcessor {
+  public:
+    static LoopProcessor* make(std::string id, ComponentGraphConfig* configPt);
+    static std::string describeThyself();
+    MelFilterbankComponent(std::string id, ComponentGraphConfig* configPt);
+    ~MelFilterbankComponent();
+
+  private:
+    void ProcessMessage(const DecoderMessageBlock& msgBlock);
+    MelBanksOptions mMelOptions;
+    bool mLogMel;
+    bool mAppendEnergy;
+    boost::shared_ptr<PowerSpectrum> mPowerSpectrum;
+    boost::shared_ptr<MelBanks> mMelBanks;
+};
+
+}
@@ -0,0 +1,78 @@
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include "Mfcc.h"
+#include <godec/ComponentGraph.h>
+#include <boost/format.hpp>
+
+namespace Godec {
+
+MfccComponent::~MfccComponent() {
+}
+
+LoopProcessor* MfccComponent::make(std::string id, ComponentGraphConfig* configPt) {
+    return new MfccComponent(id, configPt);
+}
+std::string MfccComponent::describeThyself() {
+    return "Calculates MFCC features on incoming windowed audio (feature input message produced by Window component)";
+}
+
+/* MfccComponent::ExtendedDescription
+The cepstra are the orthonormal type-II DCT of the log mel filterbank energies (same filters as the MelFilterbank component), the first "num_ceps" of them are kept. "cepstral_lifter" applies the usual sinusoidal liftering with that coefficient (0 for no liftering). "append_energy" works as in the Spectrum component
+*/
+
+MfccComponent::MfccComponent(std::string id, ComponentGraphConfig* configPt) :
+    LoopProcessor(id,configPt) {
+    mMelOptions.samplingFrequency = configPt->get<float>("sampling_frequency", "Source sampling rate");
+    mMelOptions.numMelBins = configPt->get<int>("num_mel_bins", "Number of triangular mel filters");
+    mMelOptions.lowFreq = configPt->get<float>("low_freq", "Lower edge of the lowest mel filter, in Hz");
+    mMelOptions.highFreq = configPt->get<float>("high_freq", "Upper edge of the highest mel filter, in Hz. Values <= 0 are relative to the Nyquist frequency");
+    mMelOptions.validate();
+    mNumCeps = configPt->get<int>("num_ceps", "Number of cepstra to output");
+    if (mNumCeps < 1 || mNumCeps > mMelOptions.numMelBins) GODEC_ERR << "num_ceps needs to be between 1 and num_mel_bins";
+    float lifter = configPt->get<float>("cepstral_lifter", "Cepstral liftering coefficient (0 for no liftering)");
+    mAppendEnergy = configPt->get<bool>("append_energy", "Append the frame energy in dB as a last row");
+
+    int numMel = mMelOptions.numMelBins;
+    mDct = Matrix(mNumCeps, numMel);
+    for (int cepIdx = 0; cepIdx < mNumCeps; cepIdx++) {
+        float scale = (cepIdx == 0) ? sqrt(1.0/numMel) : sqrt(2.0/numMel);
+        if (lifter != 0.0f) scale *= 1.0 + 0.5*lifter*sin(M_PI*cepIdx/lifter);
+        for (int melIdx = 0; melIdx < numMel; melIdx++) {
+            mDct(cepIdx, melIdx) = scale*cos(M_PI/numMel*(melIdx + 0.5)*cepIdx);
+        }
+    }
+
+    addInputSlotAndUUID(SlotWindowedAudio, UUID_FeaturesDecoderMessage);
+    std::list<std::string> requiredOutputSlots;
+    requiredOutputSlots.push_back(SlotFeatures);
+    initOutputs(requiredOutputSlots);
+}
+
+void MfccComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
+    auto convStateMsg = msgBlock.get<ConversationStateDecoderMessage>(SlotConversationState);
+    auto audioMsg = msgBlock.get<FeaturesDecoderMessage>(SlotWindowedAudio);
+    CheckWindowedAudio(getLPId(), *audioMsg);
+
+    if (mPowerSpectrum == nullptr) {
+        mPowerSpectrum = boost::shared_ptr<PowerSpectrum>(new PowerSpectrum(audioMsg->mFeatures.rows()));
+        mMelBanks = boost::shared_ptr<MelBanks>(new MelBanks(mPowerSpectrum->getFftSize(), mMelOptions.samplingFrequency, mMelOptions.numMelBins, mMelOptions.lowFreq, mMelOptions.highFreq));
+    }
+    Matrix powerSpectrum(mPowerSpectrum->getNumBins(), audioMsg->mFeatures.cols());
+    mPowerSpectrum->compute(audioMsg->mFeatures, powerSpectrum);
+    Matrix melEnergies(mMelOptions.numMelBins, audioMsg->mFeatures.cols());
+    mMelBanks->compute(powerSpectrum, melEnergies);
+    Matrix outMat(mNumCeps + (mAppendEnergy ? 1 : 0), audioMsg->mFeatures.cols());
+    // Coefficient-wise product, so each frame's cepstra come out the same no matter how many frames are in the chunk (a blocked matrix product would round differently)
+    outMat.topRows(mNumCeps).noalias() = mDct.lazyProduct(FloorLog(melEnergies));
+
+    boost::format fmter("CEPSMELW[0:%1%]%%f");
+    fmter % (mNumCeps - 1);
+    std::string featureNames = fmter.str();
+    if (mAppendEnergy) AppendEnergyRow(audioMsg->mFeatures, outMat, featureNames);
+
+    pushToOutputs(SlotFeatures, FeaturesDecoderMessage::create(
+                      convStateMsg->getTime(), convStateMsg->mUtteranceId,
+                      outMat, featureNames, audioMsg->mFeatureTimestamps));
+}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "MelFilterbank.h"
+
+namespace Godec {
+
+class MfccComponent : public LoopProcessor {
+  public:
+    static LoopProcessor* make(std::string id, ComponentGraphConfig* configPt);
+    static std::string describeThyself();
+    MfccComponent(std::string id, ComponentGraphConfig* configPt);
+    ~MfccComponent();
+
+  private:
+    void ProcessMessage(const DecoderMessageBlock& msgBlock);
+    MelBanksOptions mMelOptions;
+    int mNumCeps;
+    bool mAppendEnergy;
+    Matrix mDct;  ///< Type-II DCT, with the liftering folded in
+    boost::shared_ptr<PowerSpectrum> mPowerSpectrum;
+    boost::shared_ptr<MelBanks> mMelBanks;
+};
+
+}
@@ -64,7 +64,7 @@ void NoiseAddComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
     double waveStdDev = 0.0;
     const Vector& audio = audioMsg->mAudio;
     onlVariance->addData(audio);
-    waveStdDev = sqrt(onlVariance->getCovariance(false)(0, 0));
+    waveStdDev = sqrt(onlVariance->getVariance(false)(0));
     if (waveStdDev == 0.0) {
         waveStdDev = 0.001;
     }
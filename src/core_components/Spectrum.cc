@@ -0,0 +1,84 @@
+#include "Spectrum.h"
+#include <godec/ComponentGraph.h>
+#include <boost/format.hpp>
+
+namespace Godec {
+
+PowerSpectrum::PowerSpectrum(int windowSize) {
+    mWindowSize = windowSize;
+    mFftSize = 1;
+    while (mFftSize < windowSize) mFftSize *= 2;
+    mFft.SetFlag(Eigen::FFT<float>::HalfSpectrum);
+    mBins = Eigen::VectorXcf(getNumBins());
+}
+
+void PowerSpectrum::compute(const Matrix& frames, Eigen::Ref<Matrix> out) {
+    if (frames.rows() != mWindowSize) GODEC_ERR << "Expected frames of size " << mWindowSize << ", got " << frames.rows();
+    if (mPaddedFrames.cols() != frames.cols()) {
+        mPaddedFrames = Matrix::Zero(mFftSize, frames.cols());
+    }
+    mPaddedFrames.topRows(mWindowSize) = frames;
+    for (int frameIdx = 0; frameIdx < frames.cols(); frameIdx++) {
+        mFft.fwd(mBins.data(), mPaddedFrames.col(frameIdx).data(), mFftSize);
+        out.col(frameIdx) = mBins.cwiseAbs2();
+    }
+}
+
+void CheckWindowedAudio(const std::string& lpId, const FeaturesDecoderMessage& msg) {
+    if (msg.mFeatureNames.substr(0, strlen("WINAUDIO")) != "WINAUDIO") GODEC_ERR << lpId << ": Expected windowed audio, got " << msg.mFeatureNames;
+}
+
+void AppendEnergyRow(const Matrix& frames, Matrix& outMat, std::string& featureNames) {
+    outMat.bottomRows(1) = FrameEnergies(frames, true);
+    featureNames += ";R0%f";
+}
+
+SpectrumComponent::~SpectrumComponent() {
+}
+
+LoopProcessor* SpectrumComponent::make(std::string id, ComponentGraphConfig* configPt) {
+    return new SpectrumComponent(id, configPt);
+}
+std::string SpectrumComponent::describeThyself() {
+    return "Calculates the power spectrum of incoming windowed audio (feature input message produced by Window component)";
+}
+
+/* SpectrumComponent::ExtendedDescription
+The FFT size is the window size rounded up to the next power of 2, the output has (FFT size)/2+1 bins. With "log_spectrum" the output is the natural log of the power, floored at the float epsilon
+
+With "append_energy", the frame energy in dB (as in the Energy component) is added as a last row. This saves running a separate Energy component on the same windowed audio. The same option exists for MelFilterbank and Mfcc
+*/
+
+SpectrumComponent::SpectrumComponent(std::string id, ComponentGraphConfig* configPt) :
+    LoopProcessor(id,configPt) {
+    mLogSpectrum = configPt->get<bool>("log_spectrum", "Output log power spectrum instead of power spectrum (true, false)");
+    mAppendEnergy = configPt->get<bool>("append_energy", "Append the frame energy in dB as a last row");
+    addInputSlotAndUUID(SlotWindowedAudio, UUID_FeaturesDecoderMessage);
+    std::list<std::string> requiredOutputSlots;
+    requiredOutputSlots.push_back(SlotFeatures);
+    initOutputs(requiredOutputSlots);
+}
+
+void SpectrumComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
+    auto convStateMsg = msgBlock.get<ConversationStateDecoderMessage>(SlotConversationState);
+    auto audioMsg = msgBlock.get<FeaturesDecoderMessage>(SlotWindowedAudio);
+    CheckWindowedAudio(getLPId(), *audioMsg);
+
+    if (mPowerSpectrum == nullptr) mPowerSpectrum = boost::shared_ptr<PowerSpectrum>(new PowerSpectrum(audioMsg->mFeatures.rows()));
+    int numBins = mPowerSpectrum->getNumBins();
+    Matrix outMat(numBins + (mAppendEnergy ? 1 : 0), audioMsg->mFeatures.cols());
+    auto spectrum = outMat.topRows(numBins);
+    mPowerSpectrum->compute(audioMsg->mFeatures, spectrum);
+    if (mLogSpectrum) spectrum = FloorLog(spectrum);
+
+    boost::format fmter("SPECTRUM[0:%1%]%%f");
+    fmter % (numBins - 1);
+    std::string featureNames = fmter.str();
+    if (mAppendEnergy) AppendEnergyRow(audioMsg->mFeatures, outMat, featureNames);
+
+    pushToOutputs(SlotFeatures, FeaturesDecoderMessage::create(
+                      convStateMsg->getTime(), convStateMsg->mUtteranceId,
+                      outMat, featureNames, audioMsg->mFeatureTimestamps));
+}
+
+}
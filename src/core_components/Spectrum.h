@@ -0,0 +1,45 @@
+#pragma once
+
+#include <godec/ChannelMessenger.h>
+#include "GodecMessages.h"
+#include "Energy.h"
+#include <unsupported/Eigen/FFT>
+
+namespace Godec {
+
+// Power spectrum of a batch of windowed audio frames (one frame per column). The FFT size is the window size rounded up to the next power of 2, the FFT object keeps its plan between calls
+class PowerSpectrum {
+  public:
+    PowerSpectrum(int windowSize);
+    int getWindowSize() const { return mWindowSize; }
+    int getFftSize() const { return mFftSize; }
+    int getNumBins() const { return mFftSize/2+1; }
+    void compute(const Matrix& frames, Eigen::Ref<Matrix> out);
+  private:
+    int mWindowSize;
+    int mFftSize;
+    Eigen::FFT<float> mFft;
+    Matrix mPaddedFrames;
+    Eigen::VectorXcf mBins;
+};
+
+// Checks that the message contains windowed audio as produced by the Window component
+void CheckWindowedAudio(const std::string& lpId, const FeaturesDecoderMessage& msg);
+// Spectral features get the frame energy (in dB) as an optional extra last row, computed from the same frames
+void AppendEnergyRow(const Matrix& frames, Matrix& outMat, std::string& featureNames);
+
+class SpectrumComponent : public LoopProcessor {
+  public:
+    static LoopProcessor* make(std::string id, ComponentGraphConfig* configPt);
+    static std::string describeThyself();
+    SpectrumComponent(std::string id, ComponentGraphConfig* configPt);
+    ~SpectrumComponent();
+
+  private:
+    void ProcessMessage(const DecoderMessageBlock& msgBlock);
+    bool mLogSpectrum;
+    bool mAppendEnergy;
+    boost::shared_ptr<PowerSpectrum> mPowerSpectrum;
+};
+
+}
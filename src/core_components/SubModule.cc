@@ -13,6 +13,8 @@ std::string Submodule::describeThyself() {
 This component allows for a "Godec within a Godec". You specify the JSON file for that graph with the "file" parameter, and the entire sub-graph gets treated as a single component. Great for building reusable libraries.
 
 For a detailed discussion, [see here](UsingGodec.md), section "Submodules".
+
+For spreading an offline batch job over several cores, the optional "shards" parameter turns the Submodule into a self-contained batch job: The sub-graph has to contain the FileFeeder(s) and FileWriter(s), and the Submodule has no inputs or outputs. The sub-graph gets instantiated "shards" times, each FileFeeder instance feeding one consecutive block of its input list (analist, text and numpy_npz sources), and the FileWriter outputs get merged back in the original order once all shards are done. Components that carry state from one utterance to the next only see their own shard's utterances, apart from that the output is the same as without sharding. E.g. the FeatureNormalizer "covariance" statistics only get reset at the end of a conversation: analist shards never split an episode, but a numpy_npz key list is one single conversation, which each shard ends at its shard boundary
 */
 
 LoopProcessor* Submodule::make(std::string id, ComponentGraphConfig* configPt) {
@@ -20,19 +22,15 @@ LoopProcessor* Submodule::make(std::string id, ComponentGraphConfig* configPt) {
 }
 
 
-Submodule::Submodule(std::string id, ComponentGraphConfig* configPt) :
-    LoopProcessor(id, configPt) {
-    std::string includeJson = configPt->get<std::string>("file", "The json for this subnetwork");
-
-    if (!configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("inputs") || !configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("outputs"))
-        GODEC_ERR << id << ": Either no inputs or outputs defined. This make no sense for a Submodule.";
-
+json Submodule::CreateEndpoints(ComponentGraphConfig* configPt, bool verbose) {
     json endpoints;
+    // Sharded Submodules don't have any
+    if (configPt->GetPtree().count("inputs") == 0 && configPt->GetPtree().count("outputs") == 0) return endpoints;
     auto inputsChild = configPt->get_json_child("inputs");
     for(auto overrideV = inputsChild.begin(); overrideV != inputsChild.end(); overrideV++) {
         std::string endpointName = overrideV.key();
         std::vector<std::string> inputs;
-        endpoints["!"+endpointName+ComponentGraph::API_ENDPOINT_SUFFIX] = ComponentGraph::CreateApiEndpoint(isVerbose(), inputs, overrideV.key());
+        endpoints["!"+endpointName+ComponentGraph::API_ENDPOINT_SUFFIX] = ComponentGraph::CreateApiEndpoint(verbose, inputs, overrideV.key());
     }
 
     auto outputsChild = configPt->get_json_child("outputs");
@@ -40,16 +38,12 @@ Submodule::Submodule(std::string id, ComponentGraphConfig* configPt) :
         std::string endpointName = overrideV.key();
         std::vector<std::string> inputs;
         inputs.push_back(overrideV.key());
-        endpoints["!"+endpointName+ComponentGraph::API_ENDPOINT_SUFFIX] = ComponentGraph::CreateApiEndpoint(isVerbose(), inputs, "");
+        endpoints["!"+endpointName+ComponentGraph::API_ENDPOINT_SUFFIX] = ComponentGraph::CreateApiEndpoint(verbose, inputs, "");
     }
+    return endpoints;
+}
 
-    // addInputSlotAndUUID(name of slot inside sub-network that will be injected, UUID_AnyDecoderMessage);  // Replacement for above godec doc ignore
-
-    std::list<std::string> requiredOutputSlots;
-    // .push_back(Slot: name of stream inside sub-network to be pulled out);  // For godec doc
-    initOutputs(requiredOutputSlots);
-
-    GlobalComponentGraphVals* subGlobals = new GlobalComponentGraphVals(configPt->globalVals);
+json Submodule::GetOverrideTree(ComponentGraphConfig* configPt) {
     json overrideTree;
     if (configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("override")) {
         auto overrideChild = configPt->get_json_child("override");
@@ -66,9 +60,64 @@ Submodule::Submodule(std::string id, ComponentGraphConfig* configPt) :
 
         overrideTree = configPt->get_json_child("override");
     }
-    ComponentGraphConfig subCgc(id, overrideTree, NULL, GetComponentGraph());
-    mCgraph = new ComponentGraph(id, includeJson, &subCgc, endpoints, subGlobals);
+    return overrideTree;
+}
+
+json Submodule::CompileSubgraph(std::string id, ComponentGraphConfig* configPt) {
+    std::string includeJson = configPt->get<std::string>("file", "The json for this subnetwork");
+    auto verbose = configPt->get_optional_READ_DECLARATION_BEFORE_USE<bool>("verbose");
+    json endpoints = CreateEndpoints(configPt, verbose && *verbose);
+    GlobalComponentGraphVals subGlobals(configPt->globalVals);
+    ComponentGraphConfig subCgc(id, GetOverrideTree(configPt), NULL, NULL);
+    return ComponentGraph::CompileGraph(id, includeJson, &subCgc, endpoints, &subGlobals, true);
+}
+
+Submodule::Submodule(std::string id, ComponentGraphConfig* configPt) :
+    LoopProcessor(id, configPt) {
+    std::string includeJson = configPt->get<std::string>("file", "The json for this subnetwork");
+
+    int numShards = 1;
+    mSharded = false;
+    if (configPt->get_optional_READ_DECLARATION_BEFORE_USE<int>("shards")) {
+        numShards = configPt->get<int>("shards", "Number of shards the sub-graph (a batch job from FileFeeder to FileWriter) is run as, see the extended description (optional, without it the Submodule is a regular one with inputs and outputs)");
+        mSharded = true;
+    }
+    if (mSharded) {
+        if (numShards < 1) GODEC_ERR << id << ": Invalid number of shards " << numShards;
+        if (configPt->globalVals.get<int>(LoopProcessor::NumShards) > 1) GODEC_ERR << id << ": Sharded Submodules can't be nested inside another sharded Submodule";
+        if (configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("inputs") || configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("outputs"))
+            GODEC_ERR << id << ": A sharded Submodule is a self-contained batch job, it can't have inputs or outputs";
+    } else if (!configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("inputs") || !configPt->get_optional_READ_DECLARATION_BEFORE_USE<std::string>("outputs"))
+        GODEC_ERR << id << ": Either no inputs or outputs defined. This make no sense for a Submodule.";
+
+    // addInputSlotAndUUID(name of slot inside sub-network that will be injected, UUID_AnyDecoderMessage);  // Replacement for above godec doc ignore
 
+    std::list<std::string> requiredOutputSlots;
+    // .push_back(Slot: name of stream inside sub-network to be pulled out);  // For godec doc
+    initOutputs(requiredOutputSlots);
+
+    for (int shardIdx = 0; shardIdx < numShards; shardIdx++) {
+        GlobalComponentGraphVals* subGlobals = new GlobalComponentGraphVals(configPt->globalVals);
+        std::string graphId = id;
+        if (numShards > 1) {
+            // The FileFeeders and FileWriters inside pick up which shard they are working on from here
+            subGlobals->put<int>(LoopProcessor::NumShards, numShards);
+            subGlobals->put<int>(LoopProcessor::ShardIndex, shardIdx);
+            graphId = id + "_shard" + std::to_string(shardIdx);
+        }
+        if (configPt->GetPtree().count("compiled_graph") != 0) {
+            // Loaded from a compiled graph, the sub-graph was already expanded at compile time
+            json compiledGraph = configPt->get_parameter("compiled_graph", "Sub-graph as expanded by 'godec compile'");
+            mCgraphs.push_back(new ComponentGraph(graphId, compiledGraph, subGlobals));
+        } else {
+            json endpoints = CreateEndpoints(configPt, isVerbose());
+            ComponentGraphConfig subCgc(id, GetOverrideTree(configPt), NULL, GetComponentGraph());
+            mCgraphs.push_back(new ComponentGraph(graphId, includeJson, &subCgc, endpoints, subGlobals));
+        }
+    }
+    if (mSharded) return;
+
+    auto outputsChild = configPt->get_json_child("outputs");
     for(auto v = outputsChild.begin(); v != outputsChild.end(); v++) {
         std::string endpointName = id + ComponentGraph::TREE_LEVEL_SEPARATOR + v.key();
         std::string slotName = v.key();
@@ -81,17 +130,19 @@ void Submodule::Shutdown() {
     for (auto tagIt = mInputTag2Slot.begin(); tagIt != mInputTag2Slot.end(); tagIt++) {
         for (auto slotIt = tagIt->second.begin(); slotIt != tagIt->second.end(); slotIt++) {
             std::string& slot = *slotIt;
-            mCgraph->DeleteApiEndpoint(getLPId(false) + ComponentGraph::TREE_LEVEL_SEPARATOR + slot);
+            mCgraphs[0]->DeleteApiEndpoint(getLPId(false) + ComponentGraph::TREE_LEVEL_SEPARATOR + slot);
         }
     }
 
-    mCgraph->WaitTilShutdown();
-    auto stats = mCgraph->getRuntimeStats();
-    for(auto it = stats.begin(); it != stats.end(); it++) {
-        mRuntimeStats[it->first] = it->second;
+    for (auto graphIt = mCgraphs.begin(); graphIt != mCgraphs.end(); graphIt++) {
+        (*graphIt)->WaitTilShutdown();
+        auto stats = (*graphIt)->getRuntimeStats();
+        for(auto it = stats.begin(); it != stats.end(); it++) {
+            mRuntimeStats[it->first] = it->second;
+        }
+        delete *graphIt;
     }
-    delete mCgraph;
-    mCgraph = NULL;
+    mCgraphs.clear();
 
     for (auto it = mPullThreads.begin(); it != mPullThreads.end(); it++) {
         it->join();
@@ -103,14 +154,15 @@ void Submodule::Shutdown() {
             (*channelIt)->checkOut(mOutputSlot2Tag[slotIt->first]);
         }
     }
-    mIsFinished = true;
+    setFinished();
 }
 
 Submodule::~Submodule() {
 }
 
 void  Submodule::ProcessLoop() {
-    while (true) {
+    // A sharded Submodule doesn't get any input, it's done once all its shards are
+    while (!mSharded) {
         DecoderMessage_ptr newMessage;
         ChannelReturnResult res = mInputChannel.get(newMessage, FLT_MAX);
         if (res == ChannelClosed) break;
@@ -128,7 +180,7 @@ void  Submodule::ProcessLoop() {
         for (auto slotIt = mInputTag2Slot[newMessage->getTag()].begin(); slotIt != mInputTag2Slot[newMessage->getTag()].end(); slotIt++) {
             std::string& slot = *slotIt;
             DecoderMessage_ptr clonedMessage = newMessage->clone();
-            auto ep = mCgraph->GetApiEndpoint(getLPId(false) + ComponentGraph::TREE_LEVEL_SEPARATOR + slot);
+            auto ep = mCgraphs[0]->GetApiEndpoint(getLPId(false) + ComponentGraph::TREE_LEVEL_SEPARATOR + slot);
             ep->pushToOutputs(ep->getOutputSlot(), clonedMessage);
         }
     }
@@ -138,7 +190,7 @@ void  Submodule::ProcessLoop() {
 void Submodule::ProcessMessage(const DecoderMessageBlock& msgBlock) { }
 
 void Submodule::PullThread(std::string endpoint, std::string slotName) {
-    auto ep = mCgraph->GetApiEndpoint(endpoint);
+    auto ep = mCgraphs[0]->GetApiEndpoint(endpoint);
     while (true) {
         unordered_map<std::string, DecoderMessage_ptr> newSlice;
         ChannelReturnResult res = ep->PullMessage(newSlice, FLT_MAX);
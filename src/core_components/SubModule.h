@@ -12,15 +12,21 @@ class Submodule : public LoopProcessor {
     Submodule(std::string id, ComponentGraphConfig* configPt);
     ~Submodule();
     void ProcessMessage(const DecoderMessageBlock& msgBlock) override;
+    // Expands the Submodule's sub-graph (endpoints, overrides, nested Submodules) into its compiled form
+    static json CompileSubgraph(std::string id, ComponentGraphConfig* configPt);
   private:
+    static json CreateEndpoints(ComponentGraphConfig* configPt, bool verbose);
+    static json GetOverrideTree(ComponentGraphConfig* configPt);
     void ProcessLoop() override;
     void PullThread(std::string epToPull, std::string slot);
     std::vector<boost::thread> mPullThreads;
+    // Set when the Submodule runs its sub-graph as a sharded batch job, then there is one graph per shard
+    bool mSharded;
     bool RequiresConvStateInput() override { return false; }
     bool EnforceInputsOutputs() override { return false; }
   protected:
     void Shutdown() override;
-    ComponentGraph* mCgraph;
+    std::vector<ComponentGraph*> mCgraphs;
     friend class ComponentGraph;
 };
 
@@ -35,14 +35,17 @@ WindowComponent::WindowComponent(std::string id, ComponentGraphConfig* configPt)
     window = Vector(windowSize);
     if (windowingFunction == "hamming") {
         for(int idx = 0; idx < windowSize; idx++) {
-            window(idx) = 0.54-0.46*cos(2.0*M_PI/(windowSize-1));
+            window(idx) = 0.54-0.46*cos(2.0*M_PI*idx/(windowSize-1));
+        }
+    } else if (windowingFunction == "blackman") {
+        for(int idx = 0; idx < windowSize; idx++) {
+            window(idx) = 0.42-0.5*cos(2.0*M_PI*idx/(windowSize-1))+0.08*cos(4.0*M_PI*idx/(windowSize-1));
         }
     } else if (windowingFunction == "rectangle") {
         window.setConstant(1.0);
     } else {
-        GODEC_ERR << "Not implemented yet!";
+        GODEC_ERR << "Unknown windowing function '" << windowingFunction << "'. Valid options are: hamming, blackman, rectangle";
     }
-    zeroMean = AccumCovariance::make(1, Diagonal, true, false);
 
     mUttReceivedAudio = 0;
     mUttStartStreamOffset = 0;
@@ -71,32 +74,38 @@ void WindowComponent::ProcessMessage(const DecoderMessageBlock& msgBlock) {
         else GODEC_ERR << "We should never end up here";
     }
 
+    // Each frame ends at its frame pointer and reaches windowSize samples back
     Matrix outMat(windowSize, nFrames);
-    std::vector<uint64_t> outTimestamps;
-    int frameIdx = -1;
-
-    Vector rawAudioSnippet(windowSize);
-    while ((mProcessPointerInAccumAudio + stepSize) <= ((int)mAccumAudio.size() - audioHoldoff)) {
-        frameIdx++;
-        mProcessPointerInAccumAudio += stepSize;
-
-        rawAudioSnippet.setZero();
-        int64_t pickupStart = std::max((int64_t)0,mProcessPointerInAccumAudio-windowSize);
-        int64_t pickupSize = mProcessPointerInAccumAudio-pickupStart;
-        rawAudioSnippet.tail(mProcessPointerInAccumAudio-pickupStart) = mAccumAudio.segment(pickupStart, pickupSize);
-
-        zeroMean->reset();
-        zeroMean->addData(rawAudioSnippet);
-        Vector normAudio = zeroMean->normalize(rawAudioSnippet);
-        Vector filteredAudio = window.cwiseProduct(normAudio);
-
-        outMat.col(frameIdx) = filteredAudio;
-        uint64_t frameTimestamp = mUttStartStreamOffset + (int64_t)round(ticksPerSample*(mProcessPointerInAccumAudio+mAccumAudioOffsetInUtt));
-        outTimestamps.push_back(frameTimestamp);
+    std::vector<uint64_t> outTimestamps(nFrames);
+    int64_t firstFrameEnd = mProcessPointerInAccumAudio + stepSize;
+    for (int frameIdx = 0; frameIdx < nFrames; frameIdx++) {
+        int64_t frameEnd = firstFrameEnd + frameIdx*(int64_t)stepSize;
+        outTimestamps[frameIdx] = mUttStartStreamOffset + (int64_t)round(ticksPerSample*(frameEnd+mAccumAudioOffsetInUtt));
+    }
+    mProcessPointerInAccumAudio += nFrames*(int64_t)stepSize;
+
+    // Frames at the start of the utterance don't have a full window of audio yet, the missing part is zeros
+    int numPaddedFrames = 0;
+    while (numPaddedFrames < nFrames && firstFrameEnd + numPaddedFrames*(int64_t)stepSize < windowSize) {
+        int64_t frameEnd = firstFrameEnd + numPaddedFrames*(int64_t)stepSize;
+        int64_t pickupStart = std::max((int64_t)0, frameEnd-windowSize);
+        auto frame = outMat.col(numPaddedFrames);
+        frame.setZero();
+        frame.tail(frameEnd-pickupStart) = mAccumAudio.segment(pickupStart, frameEnd-pickupStart);
+        frame.array() = (frame.array() - frame.mean())*window.array();
+        numPaddedFrames++;
     }
 
-    if (outTimestamps.size() != nFrames) {
-        GODEC_ERR << "Number of frames was not estimated correctly. " << outTimestamps.size() << " vs " << nFrames << std::endl;
+    // All other frames are overlapping views into the audio, which get zero-meaned and windowed in one go
+    int numFullFrames = nFrames - numPaddedFrames;
+    if (numFullFrames > 0) {
+        int64_t firstFullFrameStart = firstFrameEnd + numPaddedFrames*(int64_t)stepSize - windowSize;
+        Eigen::Map<const Matrix, Eigen::Unaligned, Eigen::OuterStride<>> frames(mAccumAudio.data() + firstFullFrameStart, windowSize, numFullFrames, Eigen::OuterStride<>(stepSize));
+        auto fullFrames = outMat.rightCols(numFullFrames);
+        fullFrames = frames;
+        // The means are taken on the copy, whose memory layout doesn't depend on where in mAccumAudio the frames were, so neither does the summation order
+        RowVector frameMeans = fullFrames.colwise().mean();
+        fullFrames.array() = (fullFrames.rowwise() - frameMeans).array().colwise()*window.array();
     }
 
     if (convStateMsg->mLastChunkInUtt && outTimestamps.size() > 0) {
@@ -1,6 +1,5 @@
 #pragma once
 
-#include "AccumCovariance.h"
 #include <godec/ChannelMessenger.h>
 #include "GodecMessages.h"
 
@@ -16,7 +15,6 @@ class WindowComponent : public LoopProcessor {
   private:
     void ProcessMessage(const DecoderMessageBlock& msgBlock);
     Vector window;
-    boost::shared_ptr<AccumCovariance> zeroMean;
 
     Vector mAccumAudio;
     bool mLowLatency;
@@ -337,3 +337,429 @@ cnpy::NpyArray cnpy::npy_load(std::string fname) {
 
 
 
+
+//zip and npy fields are little endian and not necessarily aligned
+template<typename T> static T read_le(const unsigned char* p) {
+    T val;
+    memcpy(&val,p,sizeof(T));
+    return val;
+}
+
+size_t cnpy::parse_npy_header(const unsigned char* buffer, size_t buffer_size, npy_info& info) {
+    if(buffer_size < 10 || memcmp(buffer,"\x93NUMPY",6) != 0)
+        throw std::runtime_error("parse_npy_header: not an npy array");
+    uint8_t major_version = buffer[6];
+    size_t header_len, header_start;
+    if(major_version == 1) {
+        header_len = read_le<uint16_t>(buffer+8);
+        header_start = 10;
+    } else {
+        if(buffer_size < 12) throw std::runtime_error("parse_npy_header: truncated header");
+        header_len = read_le<uint32_t>(buffer+8);
+        header_start = 12;
+    }
+    if(header_start + header_len > buffer_size)
+        throw std::runtime_error("parse_npy_header: truncated header");
+    std::string header(reinterpret_cast<const char*>(buffer+header_start),header_len);
+
+    //descr, e.g. '<f4'
+    size_t loc1 = header.find("descr");
+    if(loc1 == std::string::npos) throw std::runtime_error("parse_npy_header: failed to find header keyword: 'descr'");
+    loc1 = header.find_first_of("'\"",header.find(':',loc1));
+    if(loc1 == std::string::npos || loc1+3 >= header.size()) throw std::runtime_error("parse_npy_header: malformed 'descr'");
+    if(header[loc1+1] == '>') throw std::runtime_error("parse_npy_header: big endian arrays are not supported");
+    info.type = header[loc1+2];
+    info.word_size = atoi(header.c_str()+loc1+3);
+
+    //fortran order
+    loc1 = header.find("fortran_order");
+    if(loc1 == std::string::npos) throw std::runtime_error("parse_npy_header: failed to find header keyword: 'fortran_order'");
+    info.fortran_order = header.compare(header.find_first_not_of("'\" :",loc1+13),4,"True") == 0;
+
+    //shape
+    loc1 = header.find("(");
+    size_t loc2 = header.find(")",loc1);
+    if(loc1 == std::string::npos || loc2 == std::string::npos) throw std::runtime_error("parse_npy_header: failed to find header keyword: '(' or ')'");
+    info.shape.clear();
+    info.num_vals = 1;
+    const char* runner = header.c_str()+loc1+1;
+    const char* end = header.c_str()+loc2;
+    while(runner < end) {
+        char* num_end;
+        unsigned long long dim = strtoull(runner,&num_end,10);
+        if(num_end == runner) {
+            runner++;
+            continue;
+        }
+        info.shape.push_back(dim);
+        info.num_vals *= dim;
+        runner = num_end;
+    }
+    return header_start + header_len;
+}
+
+cnpy::npz_file::npz_file(std::string _fname) : fname(_fname) {
+    try {
+        mapping.open(fname);
+    } catch(const std::exception& e) {
+        throw std::runtime_error("npz_file: Unable to open file "+fname+": "+e.what());
+    }
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(mapping.data());
+    size_t size = mapping.size();
+
+    //the end of central directory record sits at the very end, only followed by the (optional) zip file comment
+    if(size < 22) throw std::runtime_error("npz_file: "+fname+" is not a zip file");
+    size_t eocd = size-22;
+    size_t search_end = size > 22+65535 ? size-22-65535 : 0;
+    while(memcmp(base+eocd,"PK\x05\x06",4) != 0) {
+        if(eocd == search_end) throw std::runtime_error("npz_file: "+fname+" is not a zip file");
+        eocd--;
+    }
+    uint64_t nrecs = read_le<uint16_t>(base+eocd+10);
+    uint64_t cd_offset = read_le<uint32_t>(base+eocd+16);
+    if(nrecs == 0xFFFF || cd_offset == 0xFFFFFFFF) {
+        //zip64, the locator sits right before the regular record and points to the zip64 end of central directory
+        if(eocd < 20 || memcmp(base+eocd-20,"PK\x06\x07",4) != 0) throw std::runtime_error("npz_file: "+fname+" has a broken zip64 directory");
+        uint64_t eocd64 = read_le<uint64_t>(base+eocd-20+8);
+        if(eocd64+56 > size || memcmp(base+eocd64,"PK\x06\x06",4) != 0) throw std::runtime_error("npz_file: "+fname+" has a broken zip64 directory");
+        nrecs = read_le<uint64_t>(base+eocd64+32);
+        cd_offset = read_le<uint64_t>(base+eocd64+48);
+    }
+
+    size_t pos = cd_offset;
+    for(uint64_t rec = 0; rec < nrecs; rec++) {
+        if(pos+46 > size || memcmp(base+pos,"PK\x01\x02",4) != 0) throw std::runtime_error("npz_file: "+fname+" has a corrupt central directory");
+        npz_entry entry;
+        entry.compr_method = read_le<uint16_t>(base+pos+10);
+        entry.compr_bytes = read_le<uint32_t>(base+pos+20);
+        entry.uncompr_bytes = read_le<uint32_t>(base+pos+24);
+        uint16_t name_len = read_le<uint16_t>(base+pos+28);
+        uint16_t extra_len = read_le<uint16_t>(base+pos+30);
+        uint16_t comment_len = read_le<uint16_t>(base+pos+32);
+        entry.local_header_offset = read_le<uint32_t>(base+pos+42);
+        if(pos+46+name_len+extra_len > size) throw std::runtime_error("npz_file: "+fname+" has a corrupt central directory");
+        std::string varname(reinterpret_cast<const char*>(base+pos+46),name_len);
+
+        //numpy writes zip64 entries, those have the real sizes/offset in the extra field
+        const unsigned char* extra = base+pos+46+name_len;
+        const unsigned char* extra_end = extra+extra_len;
+        while(extra+4 <= extra_end) {
+            uint16_t tag = read_le<uint16_t>(extra);
+            uint16_t tag_size = read_le<uint16_t>(extra+2);
+            const unsigned char* field = extra+4;
+            if(tag == 0x0001) {
+                if(entry.uncompr_bytes == 0xFFFFFFFF && field+8 <= extra_end) { entry.uncompr_bytes = read_le<uint64_t>(field); field += 8; }
+                if(entry.compr_bytes == 0xFFFFFFFF && field+8 <= extra_end) { entry.compr_bytes = read_le<uint64_t>(field); field += 8; }
+                if(entry.local_header_offset == 0xFFFFFFFF && field+8 <= extra_end) { entry.local_header_offset = read_le<uint64_t>(field); field += 8; }
+            }
+            extra += 4+tag_size;
+        }
+
+        if(varname.size() > 4 && varname.compare(varname.size()-4,4,".npy") == 0) varname.erase(varname.size()-4);
+        entries[varname] = entry;
+        pos += 46+name_len+extra_len+comment_len;
+    }
+}
+
+bool cnpy::npz_file::contains(const std::string& varname) const {
+    return entries.find(varname) != entries.end();
+}
+
+std::vector<std::string> cnpy::npz_file::keys() const {
+    std::vector<std::pair<size_t,std::string>> byOffset;
+    for(auto it = entries.begin(); it != entries.end(); it++) byOffset.push_back(std::make_pair(it->second.local_header_offset,it->first));
+    std::sort(byOffset.begin(),byOffset.end());
+    std::vector<std::string> out;
+    for(auto it = byOffset.begin(); it != byOffset.end(); it++) out.push_back(it->second);
+    return out;
+}
+
+const cnpy::npz_entry& cnpy::npz_file::find_entry(const std::string& varname) const {
+    auto it = entries.find(varname);
+    if(it == entries.end()) throw std::runtime_error("npz_file: Variable name "+varname+" not found in "+fname);
+    return it->second;
+}
+
+const unsigned char* cnpy::npz_file::local_data(const npz_entry& entry) const {
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(mapping.data());
+    size_t pos = entry.local_header_offset;
+    if(pos+30 > mapping.size() || memcmp(base+pos,"PK\x03\x04",4) != 0) throw std::runtime_error("npz_file: "+fname+" has a corrupt local header");
+    //the local extra field can differ from the one in the central directory
+    pos += 30+read_le<uint16_t>(base+pos+26)+read_le<uint16_t>(base+pos+28);
+    if(pos+entry.compr_bytes > mapping.size()) throw std::runtime_error("npz_file: "+fname+" is truncated");
+    return base+pos;
+}
+
+const char* cnpy::npz_file::data_ptr(const std::string& varname, npy_info& info) const {
+    const npz_entry& entry = find_entry(varname);
+    const unsigned char* data = local_data(entry);
+    if(entry.compr_method != 0) {
+        info = npy_info();
+        return NULL;
+    }
+    size_t header_size = parse_npy_header(data,entry.compr_bytes,info);
+    if(header_size+info.num_vals*info.word_size > entry.compr_bytes) throw std::runtime_error("npz_file: array "+varname+" in "+fname+" is truncated");
+    return reinterpret_cast<const char*>(data+header_size);
+}
+
+cnpy::NpyArray cnpy::npz_file::load(const std::string& varname, npy_info& info) const {
+    const npz_entry& entry = find_entry(varname);
+    const unsigned char* data = local_data(entry);
+    std::vector<unsigned char> buffer_uncompr;
+    size_t npy_size = entry.compr_bytes;
+    if(entry.compr_method == 8) {
+        buffer_uncompr.resize(entry.uncompr_bytes);
+        z_stream d_stream;
+        d_stream.zalloc = Z_NULL;
+        d_stream.zfree = Z_NULL;
+        d_stream.opaque = Z_NULL;
+        d_stream.avail_in = 0;
+        d_stream.next_in = Z_NULL;
+        inflateInit2(&d_stream, -MAX_WBITS);
+        //zlib's counters are 32 bit, so feed it in pieces
+        const unsigned char* in = data;
+        size_t in_left = entry.compr_bytes;
+        d_stream.next_out = buffer_uncompr.data();
+        size_t out_left = buffer_uncompr.size();
+        int err = Z_OK;
+        while(err == Z_OK) {
+            uInt in_chunk = (uInt)std::min(in_left,(size_t)UINT32_MAX);
+            uInt out_chunk = (uInt)std::min(out_left,(size_t)UINT32_MAX);
+            d_stream.next_in = const_cast<unsigned char*>(in);
+            d_stream.avail_in = in_chunk;
+            d_stream.avail_out = out_chunk;
+            err = inflate(&d_stream, Z_NO_FLUSH);
+            in += in_chunk-d_stream.avail_in;
+            in_left -= in_chunk-d_stream.avail_in;
+            out_left -= out_chunk-d_stream.avail_out;
+            if(err == Z_BUF_ERROR && out_left > 0 && in_left > 0) err = Z_OK;
+        }
+        inflateEnd(&d_stream);
+        if(err != Z_STREAM_END) throw std::runtime_error("npz_file: failed to decompress "+varname+" in "+fname);
+        data = buffer_uncompr.data();
+        npy_size = buffer_uncompr.size();
+    } else if(entry.compr_method != 0) {
+        throw std::runtime_error("npz_file: unsupported compression method for "+varname+" in "+fname);
+    }
+
+    size_t header_size = parse_npy_header(data,npy_size,info);
+    NpyArray array(info.shape, info.word_size, info.fortran_order);
+    if(header_size+array.num_bytes() > npy_size) throw std::runtime_error("npz_file: array "+varname+" in "+fname+" is truncated");
+    memcpy(array.data<unsigned char>(),data+header_size,array.num_bytes());
+    return array;
+}
+
+std::vector<char> cnpy::create_npy_header(char type, size_t word_size, const std::vector<size_t>& shape, bool fortran_order, size_t total_size) {
+    std::vector<char> dict;
+    dict += "{'descr': '";
+    dict += BigEndianTest();
+    dict += type;
+    dict += std::to_string(word_size);
+    dict += "', 'fortran_order': ";
+    dict += fortran_order ? "True" : "False";
+    dict += ", 'shape': (";
+    dict += std::to_string(shape[0]);
+    for(size_t i = 1; i < shape.size(); i++) {
+        dict += ", ";
+        dict += std::to_string(shape[i]);
+    }
+    if(shape.size() == 1) dict += ",";
+    dict += "), }";
+    //pad with spaces to the requested size. preamble is 10 bytes, dict needs to end with \n
+    if(10 + dict.size() + 1 > total_size) throw std::runtime_error("create_npy_header: header doesn't fit into "+std::to_string(total_size)+" bytes");
+    dict.insert(dict.end(),total_size - 10 - dict.size(),' ');
+    dict.back() = '\n';
+
+    std::vector<char> header;
+    header += (char) 0x93;
+    header += "NUMPY";
+    header += (char) 0x01; //major version of numpy format
+    header += (char) 0x00; //minor version of numpy format
+    header += (uint16_t) dict.size();
+    header.insert(header.end(),dict.begin(),dict.end());
+    return header;
+}
+
+//the streamed arrays get a fixed size header, so it can be rewritten in place once the final shape is known. Multiple of 64 like numpy does it
+static const size_t streamed_npy_header_size = 128;
+
+static void write_or_throw(FILE* fp, const void* data, size_t nbytes) {
+    if(nbytes > 0 && fwrite(data,1,nbytes,fp) != nbytes) throw std::runtime_error("npz_writer: write failed");
+}
+
+static std::vector<char> create_local_header(const std::string& fname, uint32_t crc, uint32_t nbytes) {
+    using cnpy::operator+=;
+    std::vector<char> local_header;
+    local_header += "PK"; //first part of sig
+    local_header += (uint16_t) 0x0403; //second part of sig
+    local_header += (uint16_t) 20; //min version to extract
+    local_header += (uint16_t) 0; //general purpose bit flag
+    local_header += (uint16_t) 0; //compression method
+    local_header += (uint16_t) 0; //file last mod time
+    local_header += (uint16_t) 0;     //file last mod date
+    local_header += (uint32_t) crc; //crc
+    local_header += (uint32_t) nbytes; //compressed size
+    local_header += (uint32_t) nbytes; //uncompressed size
+    local_header += (uint16_t) fname.size(); //fname length
+    local_header += (uint16_t) 0; //extra field length
+    local_header += fname;
+    return local_header;
+}
+
+cnpy::npz_writer::npz_writer(std::string zipname) : file_pos(0), array_open(false) {
+    fp = fopen(zipname.c_str(),"wb");
+    if(!fp) throw std::runtime_error("npz_writer: Unable to open file "+zipname);
+    write_buffer.resize(1 << 20);
+    setvbuf(fp,&write_buffer[0],_IOFBF,write_buffer.size());
+}
+
+cnpy::npz_writer::~npz_writer() {
+    try {
+        close();
+    } catch(...) {
+    }
+}
+
+void cnpy::npz_writer::seek(uint64_t pos) {
+#ifdef _MSC_VER
+    int res = _fseeki64(fp,pos,SEEK_SET);
+#else
+    int res = fseeko(fp,pos,SEEK_SET);
+#endif
+    if(res != 0) throw std::runtime_error("npz_writer: seek failed");
+}
+
+void cnpy::npz_writer::begin_array(const std::string& varname, size_t _rows, char _type, size_t _word_size) {
+    if(!fp) throw std::runtime_error("npz_writer: file is already closed");
+    if(array_open) end_array();
+
+    current.fname = varname + ".npy";
+    current.local_header_offset = file_pos;
+    rows = _rows;
+    cols = 0;
+    type = _type;
+    word_size = _word_size;
+    data_crc = crc32(0L,Z_NULL,0);
+    data_bytes = 0;
+
+    //crc, sizes and shape are placeholders for now, end_array() fills them in
+    std::vector<char> local_header = create_local_header(current.fname,0,0);
+    std::vector<char> npy_header = create_npy_header(type,word_size, {rows, 0},true,streamed_npy_header_size);
+    write_or_throw(fp,&local_header[0],local_header.size());
+    write_or_throw(fp,&npy_header[0],npy_header.size());
+    file_pos += local_header.size() + npy_header.size();
+    array_open = true;
+}
+
+void cnpy::npz_writer::append_columns_raw(const void* data, size_t _cols) {
+    if(!array_open) throw std::runtime_error("npz_writer: append_columns() without begin_array()");
+    size_t nbytes = rows*_cols*word_size;
+    //zlib's length is 32 bit
+    const Bytef* runner = reinterpret_cast<const Bytef*>(data);
+    size_t remaining = nbytes;
+    while(remaining > 0) {
+        uInt chunk = (uInt)std::min(remaining,(size_t)UINT32_MAX);
+        data_crc = crc32(data_crc,runner,chunk);
+        runner += chunk;
+        remaining -= chunk;
+    }
+    write_or_throw(fp,data,nbytes);
+    file_pos += nbytes;
+    data_bytes += nbytes;
+    cols += _cols;
+}
+
+void cnpy::npz_writer::end_array() {
+    if(!array_open) return;
+    array_open = false;
+    std::vector<char> npy_header = create_npy_header(type,word_size, {rows, cols},true,streamed_npy_header_size);
+    uint64_t nbytes = npy_header.size() + data_bytes;
+    if(nbytes >= 0xFFFFFFFF) throw std::runtime_error("npz_writer: arrays of 4GB or more are not supported");
+    uint32_t crc = crc32(0L,(uint8_t*)&npy_header[0],npy_header.size());
+    crc = crc32_combine(crc,data_crc,data_bytes);
+
+    std::vector<char> local_header = create_local_header(current.fname,crc,(uint32_t)nbytes);
+    seek(current.local_header_offset);
+    write_or_throw(fp,&local_header[0],local_header.size());
+    write_or_throw(fp,&npy_header[0],npy_header.size());
+    seek(file_pos);
+
+    current.crc = crc;
+    current.nbytes = nbytes;
+    written.push_back(current);
+}
+
+void cnpy::npz_writer::close() {
+    if(!fp) return;
+    end_array();
+
+    //central directory. Offsets beyond 4GB go into a zip64 extra field
+    std::vector<char> global_header;
+    for(size_t idx = 0; idx < written.size(); idx++) {
+        const written_entry& entry = written[idx];
+        bool zip64_offset = entry.local_header_offset >= 0xFFFFFFFF;
+        global_header += "PK"; //first part of sig
+        global_header += (uint16_t) 0x0201; //second part of sig
+        global_header += (uint16_t) 45; //version made by
+        global_header += (uint16_t) (zip64_offset ? 45 : 20); //min version to extract
+        global_header += (uint16_t) 0; //general purpose bit flag
+        global_header += (uint16_t) 0; //compression method
+        global_header += (uint16_t) 0; //file last mod time
+        global_header += (uint16_t) 0;     //file last mod date
+        global_header += (uint32_t) entry.crc; //crc
+        global_header += (uint32_t) entry.nbytes; //compressed size
+        global_header += (uint32_t) entry.nbytes; //uncompressed size
+        global_header += (uint16_t) entry.fname.size(); //fname length
+        global_header += (uint16_t) (zip64_offset ? 12 : 0); //extra field length
+        global_header += (uint16_t) 0; //file comment length
+        global_header += (uint16_t) 0; //disk number where file starts
+        global_header += (uint16_t) 0; //internal file attributes
+        global_header += (uint32_t) 0; //external file attributes
+        global_header += (uint32_t) (zip64_offset ? 0xFFFFFFFF : entry.local_header_offset); //relative offset of local file header
+        global_header += entry.fname;
+        if(zip64_offset) {
+            global_header += (uint16_t) 0x0001; //zip64 extra field
+            global_header += (uint16_t) 8;
+            global_header += (uint64_t) entry.local_header_offset;
+        }
+    }
+    uint64_t global_header_offset = file_pos;
+    uint64_t nrecs = written.size();
+    write_or_throw(fp,global_header.data(),global_header.size());
+    file_pos += global_header.size();
+
+    std::vector<char> footer;
+    if(nrecs >= 0xFFFF || global_header_offset >= 0xFFFFFFFF) {
+        //zip64 end of central directory record plus locator
+        footer += "PK";
+        footer += (uint16_t) 0x0606;
+        footer += (uint64_t) 44; //size of the rest of this record
+        footer += (uint16_t) 45; //version made by
+        footer += (uint16_t) 45; //min version to extract
+        footer += (uint32_t) 0; //number of this disk
+        footer += (uint32_t) 0; //disk where central directory starts
+        footer += (uint64_t) nrecs; //number of records on this disk
+        footer += (uint64_t) nrecs; //total number of records
+        footer += (uint64_t) global_header.size(); //nbytes of global headers
+        footer += (uint64_t) global_header_offset; //offset of start of global headers
+        footer += "PK";
+        footer += (uint16_t) 0x0706;
+        footer += (uint32_t) 0; //disk with the zip64 end of central directory
+        footer += (uint64_t) file_pos; //offset of the zip64 end of central directory
+        footer += (uint32_t) 1; //total number of disks
+    }
+    footer += "PK"; //first part of sig
+    footer += (uint16_t) 0x0605; //second part of sig
+    footer += (uint16_t) 0; //number of this disk
+    footer += (uint16_t) 0; //disk where footer starts
+    footer += (uint16_t) std::min(nrecs,(uint64_t)0xFFFF); //number of records on this disk
+    footer += (uint16_t) std::min(nrecs,(uint64_t)0xFFFF); //total number of records
+    footer += (uint32_t) std::min((uint64_t)global_header.size(),(uint64_t)0xFFFFFFFF); //nbytes of global headers
+    footer += (uint32_t) std::min(global_header_offset,(uint64_t)0xFFFFFFFF); //offset of start of global headers
+    footer += (uint16_t) 0; //zip file comment length
+    write_or_throw(fp,footer.data(),footer.size());
+
+    FILE* closing_fp = fp;
+    fp = NULL;
+    if(fclose(closing_fp) != 0) throw std::runtime_error("npz_writer: failed to close file");
+}
@@ -20,6 +20,7 @@
 #include<memory>
 #include<stdint.h>
 #include<numeric>
+#include<boost/iostreams/device/mapped_file.hpp>
 
 namespace cnpy {
 
@@ -63,16 +64,98 @@ struct NpyArray {
 
 using npz_t = std::map<std::string, NpyArray>;
 
+//one array inside an npz file, as found in the zip central directory
+struct npz_entry {
+    size_t local_header_offset;
+    size_t compr_bytes;
+    size_t uncompr_bytes;
+    uint16_t compr_method;
+};
+
+//header information of an npy array
+struct npy_info {
+    char type; //numpy type character, 'f', 'i' etc
+    size_t word_size;
+    std::vector<size_t> shape;
+    bool fortran_order;
+    size_t num_vals;
+};
+
+//an npz file that gets mapped and indexed once, so that arrays can be accessed by name without scanning the whole file
+class npz_file {
+  public:
+    npz_file(std::string fname);
+    bool contains(const std::string& varname) const;
+    //in the order the arrays are stored in the file
+    std::vector<std::string> keys() const;
+    NpyArray load(const std::string& varname, npy_info& info) const;
+    //pointer to the array data inside the mapping, only possible for uncompressed entries. Returns NULL otherwise.
+    //the pointer is only valid as long as this object is alive
+    const char* data_ptr(const std::string& varname, npy_info& info) const;
+    std::string name() const { return fname; }
+  private:
+    const npz_entry& find_entry(const std::string& varname) const;
+    const unsigned char* local_data(const npz_entry& entry) const;
+    std::string fname;
+    boost::iostreams::mapped_file_source mapping;
+    std::map<std::string, npz_entry> entries;
+};
+
+
 char BigEndianTest();
 char map_type(const std::type_info& t);
 template<typename T> std::vector<char> create_npy_header(const std::vector<size_t>& shape);
+std::vector<char> create_npy_header(char type, size_t word_size, const std::vector<size_t>& shape, bool fortran_order, size_t total_size);
 void parse_npy_header(FILE* fp,size_t& word_size, std::vector<size_t>& shape, bool& fortran_order);
 void parse_npy_header(unsigned char* buffer,size_t& word_size, std::vector<size_t>& shape, bool& fortran_order);
+size_t parse_npy_header(const unsigned char* buffer, size_t buffer_size, npy_info& info);
 void parse_zip_footer(FILE* fp, uint16_t& nrecs, size_t& global_header_size, size_t& global_header_offset);
 npz_t npz_load(std::string fname);
 NpyArray npz_load(std::string fname, std::string varname);
 NpyArray npy_load(std::string fname);
 
+//writes an npz file array by array, without ever re-reading what is already written. The arrays get stored Fortran-ordered, so that
+//column-major data (e.g. Eigen matrices) can be streamed in column by column without knowing the final number of columns.
+//The central directory gets written on close(), the file is not a valid npz before that
+class npz_writer {
+  public:
+    npz_writer(std::string zipname);
+    ~npz_writer();
+    template<typename T> void begin_array(const std::string& varname, size_t rows) {
+        begin_array(varname, rows, map_type(typeid(T)), sizeof(T));
+    }
+    template<typename T> void append_columns(const T* data, size_t _rows, size_t _cols) {
+        if(sizeof(T) != word_size) throw std::runtime_error("npz_writer: appending data of the wrong type");
+        if(_rows != rows) throw std::runtime_error("npz_writer: appending "+std::to_string(_rows)+" rows to an array with "+std::to_string(rows)+" rows");
+        append_columns_raw(data, _cols);
+    }
+    void end_array();
+    void close();
+    bool in_array() const { return array_open; }
+  private:
+    struct written_entry {
+        std::string fname;
+        uint64_t local_header_offset;
+        uint32_t crc;
+        uint64_t nbytes;
+    };
+    void begin_array(const std::string& varname, size_t rows, char type, size_t word_size);
+    void append_columns_raw(const void* data, size_t cols);
+    void seek(uint64_t pos);
+    FILE* fp;
+    std::vector<char> write_buffer;
+    std::vector<written_entry> written;
+    uint64_t file_pos;
+    bool array_open;
+    written_entry current;
+    size_t rows;
+    size_t cols;
+    char type;
+    size_t word_size;
+    uint32_t data_crc;
+    uint64_t data_bytes;
+};
+
 template<typename T> std::vector<char>& operator+=(std::vector<char>& lhs, const T rhs) {
     //write in little endian
     for(size_t byte = 0; byte < sizeof(T); byte++) {
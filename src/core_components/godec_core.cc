@@ -18,6 +18,9 @@
 #include "AudioPreProcessor.h"
 #include "SubModule.h"
 #include "Window.h"
+#include "Spectrum.h"
+#include "MelFilterbank.h"
+#include "Mfcc.h"
 
 #ifdef _MSC_VER
 // Is this actually needed? Leaving it here, doesn't seem to hurt
@@ -64,6 +67,9 @@ extern "C" {
         else if (compString == "Java") return JavaComponent::make(id,configPt);
         else if (compString == "Python") return PythonComponent::make(id,configPt);
         else if (compString == "Window") return WindowComponent::make(id,configPt);
+        else if (compString == "Spectrum") return SpectrumComponent::make(id,configPt);
+        else if (compString == "MelFilterbank") return MelFilterbankComponent::make(id,configPt);
+        else if (compString == "Mfcc") return MfccComponent::make(id,configPt);
         else GODEC_ERR << "Godec core library: Asked for unknown component " << compString;
         return NULL;
     }
@@ -86,6 +92,9 @@ extern "C" {
         std::cout << "Java: " << JavaComponent::describeThyself() << std::endl;
         std::cout << "Python: " << PythonComponent::describeThyself() << std::endl;
         std::cout << "Window: " << WindowComponent::describeThyself() << std::endl;
+        std::cout << "Spectrum: " << SpectrumComponent::describeThyself() << std::endl;
+        std::cout << "MelFilterbank: " << MelFilterbankComponent::describeThyself() << std::endl;
+        std::cout << "Mfcc: " << MfccComponent::describeThyself() << std::endl;
     }
 
     // For checking whether all libraries are of the same version
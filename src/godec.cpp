@@ -47,7 +47,8 @@ void PrintUsage() {
               "Godec, the stream processing engine\n\n"
               "Usage:\n"
               "  godec [overrides] <json>    | Overrides are specified with '-x \"a.b=c\"', where a is top-level component, b its child parameter.\n"
-              "  godec list <core|libname>   | List available components in library. Library is looked up as libgodec_<libname>.so\n";
+              "  godec list <core|libname>   | List available components in library. Library is looked up as libgodec_<libname>.so\n"
+              "  godec [overrides] compile <json> -o <out> | Compile graph (overrides applied, Submodules expanded) into a binary file that loads without any JSON processing\n";
 }
 
 #ifndef ANDROID
@@ -65,6 +66,7 @@ int main(int argc, char** argv) {
     ("x", po::value<OverrideValues>(&ovOpts)->default_value(boost::assign::list_of(""), "")->composing(), "overrides")
     ("pos_opts", po::value<OverrideValues>(&ovOpts)->default_value(boost::assign::list_of(""), "")->composing(), "")
     ("java_class_path", po::value<std::string>(), "Java class path")
+    ("o", po::value<std::string>(), "Output file for compiled graph")
     ;
 
     po::variables_map vm;
@@ -107,6 +109,19 @@ int main(int argc, char** argv) {
         ov.push_back(std::make_pair(key, val));
     }
 
+    if (jsonOrCommand == "compile") {
+        if (posOpts.size() != 2 || !vm.count("o")) { PrintUsage(); exit(-1);}
+        GlobalComponentGraphVals globals;
+        globals.put<bool>(LoopProcessor::QuietGodec,vm.count("q") == 1);
+        ComponentGraphConfig* overrides = ComponentGraphConfig::FromOverrideList(ov);
+        json endpoints;
+        json compiledGraph = ComponentGraph::CompileGraph(ComponentGraph::TOPLEVEL_ID, posOpts[1], overrides, endpoints, &globals, true);
+        ComponentGraph::ValidateCompiledGraph(compiledGraph, ComponentGraph::TOPLEVEL_ID);
+        ComponentGraph::SaveCompiledGraph(compiledGraph, vm["o"].as<std::string>());
+        FlushLog();
+        _exit(0); // See beginning of file for explanation
+    }
+
     // Set up Java env variables when using the 'Java' component (not necessary for Android where this is already set up)
 #ifndef ANDROID
     if (vm.count("java_class_path")) {
@@ -130,6 +145,7 @@ int main(int argc, char** argv) {
     ComponentGraph* cGraph = new ComponentGraph(ComponentGraph::TOPLEVEL_ID, jsonOrCommand, overrides, endpoints, &globals);
     cGraph->WaitTilShutdown();
     delete cGraph;
+    FlushLog(); // _exit() skips the log writer's shutdown
     _exit(0); // See beginning of file for explanation
     return 0;
 }
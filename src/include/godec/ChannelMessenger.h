@@ -3,6 +3,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <atomic>
 #include <iostream>
 #include "TimeStream.h"
 #include "channel.h"
@@ -221,6 +222,9 @@ class LoopProcessor {
     static std::string SlotCnetLattice;
     static std::string GatherRuntimeStats;
     static std::string QuietGodec;
+    // Set by sharded Submodules for the sub-graph of each shard
+    static std::string NumShards;
+    static std::string ShardIndex;
     static std::string SlotTimeMap;
     static std::string SlotControl;
     static std::string SlotSearchOutput;
@@ -253,10 +257,12 @@ class LoopProcessor {
     boost::thread mProcThread;
     std::string mId;
     bool mVerbose;
-    bool mIsFinished;
+    std::atomic<bool> mIsFinished;
     FILE* mLogPtr;
 
     void connectInputs(unordered_map<std::string, std::set<uuid>> requiredSlots);
+    // Sets mIsFinished and lets the ComponentGraph know
+    void setFinished();
 
     ComponentGraphConfig* mPt;
 
@@ -332,25 +338,12 @@ class ComponentGraphConfig {
             GODEC_ERR << mId << ": Parameter '" << s << "' not specified" << std::endl << "Description: " << desc << std::endl;
         }
         mConsumedOptions.insert(s);
-        // Resolve vars
         std::string outVal = Json2String(pt[s]);
-        std::string baseVal = outVal;
-#ifdef USE_STD_REGEX
-        std::regex regex("\\$\\([^)]+\\)");
-        std::sregex_token_iterator iter(baseVal.begin(), baseVal.end(), regex, 0);
-        std::sregex_token_iterator end;
-#else
-        boost::regex regex("\\$\\([^)]+\\)");
-        boost::sregex_token_iterator iter(baseVal.begin(), baseVal.end(), regex, 0);
-        boost::sregex_token_iterator end;
-#endif
-        for (; iter != end; iter++) {
-            std::string var = *iter;
-            var = var.substr(2, var.length() - 3);
-            if (!globalVals.exists(var)) { GODEC_ERR << mId << ": Global variable '" << var << "' is not defined!" << std::endl; }
-            boost::replace_all(outVal, "$(" + var + ")", globalVals.get<std::string>(var));
+        // Vars are normally already resolved by ResolveGlobalVars() at graph load time, this only catches configs that weren't pre-resolved
+        if (outVal.find("$(") != std::string::npos) {
+            outVal = ResolveGlobalVarsInString(outVal);
+            pt[s] = outVal;
         }
-        pt[s] = outVal;
         try {
             if constexpr (std::is_same<T, bool>::value) {
                 std::istringstream ss(outVal);
@@ -407,6 +400,8 @@ class ComponentGraphConfig {
     }
 
     void ParameterCheck();
+    // Expands all "$(var)" references in the config's parameters against the global variables. Gets called once after the config is fully assembled, so that get() is a simple typed lookup
+    void ResolveGlobalVars();
     std::string AsString();
     static ComponentGraphConfig* FromOverrideList(std::vector<std::pair<std::string, std::string>> ov);
     ComponentGraphConfig* GetSubtree(std::string child, bool remove);
@@ -437,9 +432,11 @@ class ComponentGraphConfig {
     ComponentGraph* GetComponentGraph() {return mComponentGraph;}
 
   private:
+    std::string ResolveGlobalVarsInString(const std::string& in, bool errorOnUndefined = true);
     std::string mId;
     json pt;
     unordered_set<std::string> mConsumedOptions;
+    unordered_map<std::string, std::string> mResolvedVars;
     bool mTopLevel;
     ComponentGraph* mComponentGraph;
 };
@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <mutex>
+#include <condition_variable>
 #include "ChannelMessenger.h"
 
 namespace Godec {
@@ -26,10 +27,14 @@ DllPtr;
 class ComponentGraph {
   public:
     ComponentGraph(std::string prefix, std::string inFile, ComponentGraphConfig* overrideTree, json& injectedEndpoints, GlobalComponentGraphVals* globalVals);
+    // Instantiates a graph that was already assembled by CompileGraph()
+    ComponentGraph(std::string prefix, json& compiledGraph, GlobalComponentGraphVals* globalVals);
     ~ComponentGraph();
     static void PrintHelp();
     static json CreateApiEndpoint(bool verbose, std::vector<std::string> inputs, std::string output);
     void WaitTilShutdown();
+    // Called by components once they are finished, wakes up WaitTilShutdown()
+    void ComponentFinished(LoopProcessor* lp);
     boost::shared_ptr<ApiEndpoint> GetApiEndpoint(std::string endpointName);
     void DeleteApiEndpoint(std::string endpointName);
     unordered_map<std::string, ChannelPointerList*>& getGlobalOutputSlots() {return mGlobalOutputSlots;}
@@ -39,6 +44,14 @@ class ComponentGraph {
     unordered_map<std::string, RuntimeStats> GetRuntimeStats();
     unordered_map<std::string, boost::shared_ptr<RuntimeStats> > getRuntimeStats();
     static void ListComponents(std::string dllName);
+    // Does all the JSON work of loading a graph (comment stripping, endpoint injection, overrides, globals, variable resolution). With expandSubmodules, Submodules get their sub-graph compiled in as well
+    static json CompileGraph(std::string prefix, std::string inFile, ComponentGraphConfig* overrideTree, json& injectedEndpoints, GlobalComponentGraphVals* globalVals, bool expandSubmodules);
+    // Checks the stream wiring of a compiled graph, including all of its expanded Submodules
+    static void ValidateCompiledGraph(json& compiledGraph, std::string prefix);
+    static void SaveCompiledGraph(json& compiledGraph, std::string outFile);
+    static json LoadCompiledGraph(std::string inFile);
+    static bool IsCompiledGraphFile(std::string inFile);
+    static std::string COMPILED_GRAPH_MAGIC;
     static std::string API_ENDPOINT_SUFFIX;
     static std::string TOPLEVEL_ID;
     static std::string TREE_LEVEL_SEPARATOR;
@@ -50,9 +63,14 @@ class ComponentGraph {
   private:
     static unordered_map < std::string, std::pair<boost::function<LoopProcessor*(std::string, ComponentGraphConfig*)>, boost::function<std::string()>>> GetComponentHash();
     std::mutex mComponentsMutex;
+    std::condition_variable mShutdownCondition;
     unordered_map<std::string, boost::shared_ptr<LoopProcessor>> mComponents;
     unordered_map<std::string, ChannelPointerList*> mGlobalOutputSlots;
 
+    void InstantiateComponents(json& compiledGraph, GlobalComponentGraphVals* globalVals);
+    static bool IsSubmoduleType(std::string compType);
+    // Component types that can't be constructed concurrently with others
+    static bool RequiresSequentialConstruction(std::string compType);
     LoopProcessor* LoadComponent(std::string compType, std::string compName, ComponentGraphConfig* compConfig);
     static DllPtr LoadGodecLibrary(std::string dllName);
 
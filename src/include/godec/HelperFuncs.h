@@ -77,10 +77,12 @@ std::string CdToFilePath(std::string path); // Returns cwd, for restoring later
 #define __func__ __FUNCTION__
 #endif
 
-// Logging structures. Each thread maintains its own logging handle
-extern unordered_map<std::string, std::pair<bool, FILE*>> GlobalThreadId2LogHandle;
-
+// Logging structures. Each thread maintains its own logging handle. Info messages get queued and written out by a background thread, errors are written synchronously
 void RegisterThreadForLogging(boost::thread& thread, FILE* logPtr, bool verbose);
+// Whether GODEC_INFO output of the calling thread gets written at all
+bool ThreadLogIsVerbose();
+// Blocks until all queued log messages are written out
+void FlushLog();
 
 struct LogMessageEnvelope {
     enum Severity {
@@ -121,7 +123,14 @@ class GodecErrorLogger {
 
 
 #define GODEC_ERR Godec::GodecErrorLogger(LogMessageEnvelope::kError, __func__, __FILE__, __LINE__).stream()
-#define GODEC_INFO Godec::GodecErrorLogger(LogMessageEnvelope::kInfo, __func__, __FILE__, __LINE__).stream()
+// Lets GODEC_INFO be a single expression: '&' binds weaker than '<<', so the whole message gets streamed before it turns into void
+class GodecLogVoidify {
+  public:
+    void operator&(std::ostream&) {}
+};
+
+// The message doesn't even get assembled if the thread's logging isn't verbose. Being an expression (rather than an if/else), it can't capture a caller's 'else'
+#define GODEC_INFO !Godec::ThreadLogIsVerbose() ? (void)0 : Godec::GodecLogVoidify() & Godec::GodecErrorLogger(LogMessageEnvelope::kInfo, __func__, __FILE__, __LINE__).stream()
 
 std::vector<unsigned char> String2CharVec(std::string s);
 std::string CharVec2String(std::vector<unsigned char> v);
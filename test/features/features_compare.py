@@ -0,0 +1,70 @@
+import sys
+import numpy as np
+
+# Recomputes spectrum, mel filterbank and MFCCs from Godec's windowed frames in double precision and compares them to what the Spectrum, MelFilterbank and Mfcc components produced (see features_test.json for the settings)
+sampleRate = 16000.0
+fftSize = 512
+numMel = 23
+lowFreq = 20.0
+highFreq = sampleRate/2-400.0
+numCeps = 13
+lifter = 22.0
+# Allowed relative deviation from the double-precision reference. MFCCs get more slack since liftering scales the higher coefficients by up to 1+lifter/2
+tolerances = {"spectrum": 1E-05, "fbank": 1E-05, "mfcc": 5E-04}
+
+def mel(f):
+  return 1127.0*np.log(1.0+f/700.0)
+
+numBins = fftSize//2+1
+binMel = mel(np.arange(numBins)*sampleRate/fftSize)
+melLow = mel(lowFreq)
+melDelta = (mel(highFreq)-melLow)/(numMel+1)
+melBanks = np.zeros((numMel, numBins))
+for binIdx in range(numMel):
+  left = melLow+binIdx*melDelta
+  center = left+melDelta
+  right = center+melDelta
+  inside = (binMel > left) & (binMel < right)
+  melBanks[binIdx] = np.where(inside, np.where(binMel <= center, (binMel-left)/melDelta, (right-binMel)/melDelta), 0.0)
+
+cepIdx = np.arange(numCeps)[:, None]
+melIdx = np.arange(numMel)[None, :]
+dct = np.sqrt(2.0/numMel)*np.cos(np.pi/numMel*(melIdx+0.5)*cepIdx)
+dct[0] = np.sqrt(1.0/numMel)
+dct *= (1.0+0.5*lifter*np.sin(np.pi*np.arange(numCeps)/lifter))[:, None]
+
+eps = np.finfo(np.float32).eps
+window = np.load("_window.npz")
+godecFeats = {}
+for name in ["spectrum", "fbank", "mfcc"]:
+  godecFeats[name] = np.load("_"+name+".npz")
+  if (godecFeats[name].files != window.files):
+    sys.stderr.write("Different entries in "+name+" npz!\n")
+    sys.stderr.flush()
+    exit(-1)
+
+for uttId in window.files:
+  frames = window[uttId].astype(np.float64)
+  power = np.abs(np.fft.rfft(frames, n=fftSize, axis=0))**2
+  refFeats = {}
+  refFeats["spectrum"] = np.log(np.maximum(power, eps))
+  refFeats["fbank"] = np.log(np.maximum(melBanks.dot(power), eps))
+  # The Mfcc component also appends the frame energy in dB
+  energy = np.sum(np.square(frames), axis=0)
+  energy = np.where(energy < 1E-25, 1E-10, 10.0*np.log10(np.maximum(energy, 1E-25)))
+  refFeats["mfcc"] = np.vstack((dct.dot(refFeats["fbank"]), energy))
+  for name in ["spectrum", "fbank", "mfcc"]:
+    godecMat = godecFeats[name][uttId]
+    if (godecMat.shape != refFeats[name].shape):
+      sys.stderr.write("Matrices for "+name+" utt "+uttId+" have different shape! "+str(godecMat.shape)+" vs "+str(refFeats[name].shape)+"\n")
+      sys.stderr.flush()
+      exit(-1)
+    if (name == "spectrum"):
+      # Single-precision FFT noise is relative to the strongest bin of the frame, so a log comparison would blow it up in near-empty bins
+      maxDiff = np.max(np.abs(np.exp(godecMat.astype(np.float64))-np.maximum(power, eps))/np.maximum(np.max(power, axis=0), eps))
+    else:
+      maxDiff = np.max(np.abs(godecMat-refFeats[name])/np.maximum(1.0, np.abs(refFeats[name])))
+    if (maxDiff > tolerances[name]):
+      sys.stderr.write("Different "+name+" matrices for utt "+uttId+" (max diff "+str(maxDiff)+")\n")
+      sys.stderr.flush()
+      exit(-1)
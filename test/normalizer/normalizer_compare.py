@@ -0,0 +1,60 @@
+import sys
+import numpy as np
+
+# Recomputes the FeatureNormalizer outputs of normalizer_test.json in double precision from the input features
+feats = np.load("../sharding/sharding_feats.npz")
+eps = np.finfo(np.float32).eps
+hop = 5
+
+def sliding_window(x, windowSize, lookahead, normMeans, normVars):
+  numFrames = x.shape[1]
+  out = np.zeros(x.shape)
+  for t in range(numFrames):
+    # The window ends "lookahead" frames after the current one, cut off at both utterance ends
+    window = x[:, max(0, t+lookahead-windowSize+1):min(numFrames, t+lookahead+1)]
+    mean = np.mean(window, axis=1)
+    invStdDev = np.ones(x.shape[0])
+    if (normVars):
+      var = np.mean(np.square(window), axis=1)-np.square(mean)
+      invStdDev = np.where(var > eps, 1.0/np.sqrt(np.maximum(var, eps)), 1.0)
+    out[:, t] = ((x[:, t]-mean) if normMeans else x[:, t])*invStdDev
+  return out
+
+def n_frame_average(x, zeroPad):
+  # One output per hop of input frames, averaging the last "hop" frames
+  numFrames = x.shape[1]
+  out = []
+  for hopEnd in range(hop, numFrames+hop, hop):
+    hopEnd = min(hopEnd, numFrames)
+    frames = x[:, max(0, hopEnd-hop):hopEnd]
+    out.append(np.sum(frames, axis=1)/(hop if zeroPad else frames.shape[1]))
+  return np.stack(out, axis=1)
+
+references = {
+  "sw_lowlat_l0": lambda x: sliding_window(x, 8, 0, True, True),
+  "sw_lowlat_l3": lambda x: sliding_window(x, 8, 3, True, True),
+  "sw_lowlat_l7": lambda x: sliding_window(x, 8, 7, False, True),
+  "sw_batch_l0": lambda x: sliding_window(x, 8, 0, True, True),
+  "sw_batch_l3": lambda x: sliding_window(x, 8, 3, True, False),
+  "nfa_pad": lambda x: n_frame_average(x, True),
+  "nfa_nopad": lambda x: n_frame_average(x, False),
+}
+
+for name, reference in references.items():
+  godecFeats = np.load("_"+name+".npz")
+  if (godecFeats.files != feats.files):
+    sys.stderr.write("Different entries in "+name+" npz!\n")
+    sys.stderr.flush()
+    exit(-1)
+  for uttId in feats.files:
+    refMat = reference(feats[uttId].astype(np.float64))
+    godecMat = godecFeats[uttId]
+    if (godecMat.shape != refMat.shape):
+      sys.stderr.write("Matrices for "+name+" utt "+uttId+" have different shape! "+str(godecMat.shape)+" vs "+str(refMat.shape)+"\n")
+      sys.stderr.flush()
+      exit(-1)
+    maxDiff = np.max(np.abs(godecMat-refMat)/np.maximum(1.0, np.abs(refMat)))
+    if (maxDiff > 1E-06):
+      sys.stderr.write("Different "+name+" matrices for utt "+uttId+" (max diff "+str(maxDiff)+")\n")
+      sys.stderr.flush()
+      exit(-1)
@@ -0,0 +1,27 @@
+import sys
+import array
+
+# Compares two raw 16-bit little-endian audio files sample by sample. The resampler is allowed to deviate from the reference output by at most 2 LSB
+maxAllowedDiff = 2
+
+def load_samples(fileName):
+  samples = array.array('h')
+  with open(fileName, 'rb') as f:
+    samples.frombytes(f.read())
+  if (sys.byteorder == 'big'):
+    samples.byteswap()
+  return samples
+
+refSamples = load_samples(sys.argv[1])
+testSamples = load_samples(sys.argv[2])
+if (len(refSamples) != len(testSamples)):
+  sys.stderr.write("Different number of samples! "+str(len(refSamples))+" vs "+str(len(testSamples))+"\n")
+  sys.stderr.flush()
+  exit(-1)
+maxDiff = 0
+for refSample, testSample in zip(refSamples, testSamples):
+  maxDiff = max(maxDiff, abs(refSample-testSample))
+if (maxDiff > maxAllowedDiff):
+  sys.stderr.write("Resampled audio deviates from reference by "+str(maxDiff)+" LSB\n")
+  sys.stderr.flush()
+  exit(-1)